@@ -0,0 +1,559 @@
+/**
+ * Arduino Remote Procedure Calls - ArduRPC
+ * Copyright (C) 2013-2016 DinoTools
+ *
+ * This file is part of ArduRPC.
+ *
+ * ArduRPC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * ArduRPC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Benchmark of the functions used to encode and decode values.
+ *
+ * Every value type is checked against known byte sequences (golden vectors)
+ * and encoded and decoded with pseudo random values generated from a fixed
+ * seed. After that the time of the following operations is measured:
+ *
+ *   - getParam: ArduRPCContext::getParam_*()
+ *   - result:   ArduRPCContext::writeResult_*()
+ *   - inline:   rpc_read_*()
+ *   - request:  ArduRPCRequest::writeRequest_*()
+ *   - read:     ArduRPCRequest::readResult_*()
+ *
+ * The getParam_*() and writeResult_*() functions of ArduRPC only forward to
+ * the current context and are not measured separately.
+ *
+ * Open the serial monitor with 115200 baud to see the results. Every line
+ * contains the type, the operation, the time per value in ns (or cycles) and
+ * the throughput in bytes/s.
+ *
+ * With BENCH_CYCLES set to 1 the CPU cycles are counted with Timer1 instead of
+ * using micros(). This is only available on AVR boards. Run the sketch in a
+ * cycle accurate simulator (e.g. simavr) to get reproducible numbers.
+ */
+
+#include <ArduRPC.h>
+
+//! Number of values processed in one measurement
+#define BENCH_BATCH 16
+//! Number of measurements for every operation
+#define BENCH_ROUNDS 64
+//! Seed of the pseudo random values
+#define BENCH_SEED 0x2545f491UL
+//! Count CPU cycles with Timer1 (AVR only)
+#define BENCH_CYCLES 0
+
+#if BENCH_CYCLES == 1 && !defined(__AVR__)
+#error "BENCH_CYCLES is only available on AVR boards"
+#endif
+
+/**
+ * Connection keeping the request instead of sending it.
+ */
+class BenchConnection : public ArduRPCRequestConnection
+{
+  public:
+    void reset() {}
+    void send(rpc_data_t request)
+    {
+      // Remove the header
+      this->length = request.length - 4;
+      memcpy(this->data, &request.data[4], this->length);
+    }
+    bool waitResult()
+    {
+      return true;
+    }
+    //! Parameters of the last request
+    uint8_t data[RPC_MAX_DATA_LENGTH];
+    //! Number of bytes in the data buffer
+    uint8_t length;
+};
+
+//! Type of a benchmark function processing the given number of values
+typedef void (*bench_function_t)(uint8_t count);
+
+//! Functions of a value type
+typedef struct {
+  //! Write the values with ArduRPCRequest::writeRequest_*()
+  bench_function_t writeRequest;
+  //! Write the values with ArduRPCContext::writeResult_*()
+  bench_function_t writeResult;
+  //! Read the values with ArduRPCContext::getParam_*()
+  bench_function_t getParam;
+  //! Read the values with rpc_read_*() or NULL
+  bench_function_t readInline;
+  //! Read the values with ArduRPCRequest::readResult_*() or NULL
+  bench_function_t readResult;
+  //! Check the given number of values decoded by the last read function
+  bool (*verify)(uint8_t count);
+} bench_codec_t;
+
+ArduRPCContext ctx;
+ArduRPCRequest request;
+BenchConnection connection;
+
+//! Pseudo random values
+uint32_t values[BENCH_BATCH];
+//! The pseudo random values as float
+float float_values[BENCH_BATCH];
+//! Values decoded by the last read function
+uint32_t decoded[BENCH_BATCH];
+//! Floats decoded by the last read function
+float float_decoded[BENCH_BATCH];
+//! String used for all string benchmarks
+char bench_string[] = "ArduRPC codec";
+//! Buffer for decoded strings
+char string_buffer[sizeof(bench_string)];
+
+//! Values encoded without type (parameters)
+uint8_t param_data[RPC_MAX_DATA_LENGTH];
+uint8_t param_length;
+//! Values encoded with type (result)
+uint8_t result_data[RPC_MAX_RESULT_LENGTH];
+uint8_t result_length;
+
+//! Number of failed checks
+uint8_t failed;
+//! State of the pseudo random number generator
+uint32_t random_state = BENCH_SEED;
+
+/**
+ * Get the next pseudo random number (xorshift32).
+ */
+uint32_t nextRandom()
+{
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 17;
+  random_state ^= random_state << 5;
+  return random_state;
+}
+
+/**
+ * Convert the raw value of a float into a float.
+ */
+float toFloat(uint32_t value)
+{
+  float res;
+  memcpy(&res, &value, sizeof(res));
+  return res;
+}
+
+/**
+ * Define the benchmark functions of a value type.
+ *
+ * @param name Suffix of the functions (e.g. uint16 for getParam_uint16())
+ * @param ctype C type of the values
+ * @param src Array with the values to encode
+ * @param dst Array for the decoded values
+ */
+#define BENCH_CODEC(name, ctype, src, dst) \
+  void name##_writeRequest(uint8_t count) \
+  { \
+    for (uint8_t i = 0; i < count; i++) { \
+      request.writeRequest_##name((ctype)src[i]); \
+    } \
+  } \
+  void name##_writeResult(uint8_t count) \
+  { \
+    for (uint8_t i = 0; i < count; i++) { \
+      ctx.writeResult_##name((ctype)src[i]); \
+    } \
+  } \
+  void name##_getParam(uint8_t count) \
+  { \
+    for (uint8_t i = 0; i < count; i++) { \
+      dst[i] = ctx.getParam_##name(); \
+    } \
+  } \
+  bool name##_verify(uint8_t count) \
+  { \
+    for (uint8_t i = 0; i < count; i++) { \
+      if ((ctype)dst[i] != (ctype)src[i]) { \
+        return false; \
+      } \
+    } \
+    return true; \
+  }
+
+//! Define the benchmark function for ArduRPCRequest::readResult_*()
+#define BENCH_READ_RESULT(name) \
+  void name##_readResult(uint8_t count) \
+  { \
+    for (uint8_t i = 0; i < count; i++) { \
+      decoded[i] = request.readResult_##name(); \
+    } \
+  }
+
+//! Define the benchmark function for rpc_read_*()
+#define BENCH_READ_INLINE(name, size) \
+  void name##_readInline(uint8_t count) \
+  { \
+    uint8_t *data = param_data; \
+    for (uint8_t i = 0; i < count; i++) { \
+      decoded[i] = rpc_read_##name(data); \
+      data += size; \
+    } \
+  }
+
+BENCH_CODEC(int8, int8_t, values, decoded)
+BENCH_CODEC(int16, int16_t, values, decoded)
+BENCH_CODEC(int32, int32_t, values, decoded)
+BENCH_CODEC(uint8, uint8_t, values, decoded)
+BENCH_CODEC(uint16, uint16_t, values, decoded)
+BENCH_CODEC(uint32, uint32_t, values, decoded)
+BENCH_CODEC(varint, int32_t, values, decoded)
+BENCH_CODEC(varuint, uint32_t, values, decoded)
+BENCH_CODEC(float, float, float_values, float_decoded)
+
+BENCH_READ_RESULT(int8)
+BENCH_READ_RESULT(int16)
+BENCH_READ_RESULT(int32)
+BENCH_READ_RESULT(uint8)
+BENCH_READ_RESULT(uint16)
+BENCH_READ_RESULT(uint32)
+BENCH_READ_RESULT(varint)
+BENCH_READ_RESULT(varuint)
+
+BENCH_READ_INLINE(int8, 1)
+BENCH_READ_INLINE(int16, 2)
+BENCH_READ_INLINE(int32, 4)
+BENCH_READ_INLINE(uint8, 1)
+BENCH_READ_INLINE(uint16, 2)
+BENCH_READ_INLINE(uint32, 4)
+
+void string_writeRequest(uint8_t count)
+{
+  for (uint8_t i = 0; i < count; i++) {
+    request.writeRequest_string(bench_string);
+  }
+}
+
+void string_writeResult(uint8_t count)
+{
+  for (uint8_t i = 0; i < count; i++) {
+    ctx.writeResult_string(bench_string, sizeof(bench_string) - 1);
+  }
+}
+
+void string_getParam(uint8_t count)
+{
+  for (uint8_t i = 0; i < count; i++) {
+    decoded[i] = ctx.getParam_string(string_buffer, sizeof(string_buffer));
+  }
+}
+
+void string_readResult(uint8_t count)
+{
+  for (uint8_t i = 0; i < count; i++) {
+    decoded[i] = request.readResult_string(string_buffer, sizeof(string_buffer));
+  }
+}
+
+bool string_verify(uint8_t count)
+{
+  for (uint8_t i = 0; i < count; i++) {
+    if (decoded[i] != sizeof(bench_string) - 1) {
+      return false;
+    }
+  }
+  return strcmp(string_buffer, bench_string) == 0;
+}
+
+#define BENCH_ENTRY(name, read_inline, read_result) \
+  {name##_writeRequest, name##_writeResult, name##_getParam, read_inline, read_result, name##_verify}
+
+//! Value types in the order of the golden vectors
+const bench_codec_t codecs[] = {
+  BENCH_ENTRY(int8, int8_readInline, int8_readResult),
+  BENCH_ENTRY(int16, int16_readInline, int16_readResult),
+  BENCH_ENTRY(int32, int32_readInline, int32_readResult),
+  BENCH_ENTRY(uint8, uint8_readInline, uint8_readResult),
+  BENCH_ENTRY(uint16, uint16_readInline, uint16_readResult),
+  BENCH_ENTRY(uint32, uint32_readInline, uint32_readResult),
+  BENCH_ENTRY(varint, NULL, varint_readResult),
+  BENCH_ENTRY(varuint, NULL, varuint_readResult),
+  BENCH_ENTRY(float, NULL, NULL),
+  BENCH_ENTRY(string, NULL, string_readResult)
+};
+
+const char *const codec_names[] = {
+  "int8", "int16", "int32", "uint8", "uint16", "uint32", "varint", "varuint", "float", "string"
+};
+
+//! Type identifier of the value types
+const uint8_t codec_types[] = {
+  RPC_INT8, RPC_INT16, RPC_INT32, RPC_UINT8, RPC_UINT16, RPC_UINT32, RPC_VARINT, RPC_VARUINT, RPC_FLOAT, RPC_STRING
+};
+
+//! Golden vectors: the raw value followed by the length and the expected encoding
+const uint8_t golden[] PROGMEM = {
+  // int8: -123
+  0xff, 0xff, 0xff, 0x85, 1, 0x85,
+  // int16: -12345
+  0xff, 0xff, 0xcf, 0xc7, 2, 0xcf, 0xc7,
+  // int32: -123456789
+  0xf8, 0xa4, 0x32, 0xeb, 4, 0xf8, 0xa4, 0x32, 0xeb,
+  // uint8: 200
+  0x00, 0x00, 0x00, 0xc8, 1, 0xc8,
+  // uint16: 54321
+  0x00, 0x00, 0xd4, 0x31, 2, 0xd4, 0x31,
+  // uint32: 3735928559
+  0xde, 0xad, 0xbe, 0xef, 4, 0xde, 0xad, 0xbe, 0xef,
+  // varint: -150
+  0xff, 0xff, 0xff, 0x6a, 2, 0xab, 0x02,
+  // varuint: 300
+  0x00, 0x00, 0x01, 0x2c, 2, 0xac, 0x02,
+  // float: -3.1415927
+  0xc0, 0x49, 0x0f, 0xdb, 4, 0xc0, 0x49, 0x0f, 0xdb,
+  // string: "ArduRPC codec", the value is not used
+  0x00, 0x00, 0x00, 0x00, 14, 13, 'A', 'r', 'd', 'u', 'R', 'P', 'C', ' ', 'c', 'o', 'd', 'e', 'c'
+};
+
+/**
+ * Encode all values with the given functions into param_data and result_data.
+ */
+void encode(const bench_codec_t *codec, uint8_t count)
+{
+  request.reset();
+  codec->writeRequest(count);
+  request.send(0x00, 0x00);
+  param_length = connection.length;
+  memcpy(param_data, connection.data, param_length);
+
+  ctx.reset();
+  codec->writeResult(count);
+  result_length = ctx.getResultDataLength();
+  memcpy(result_data, ctx.getResultData() + 1, result_length);
+}
+
+void prepareNone(uint8_t count)
+{
+}
+
+void prepareGetParam(uint8_t count)
+{
+  ctx.reset();
+  ctx.copyData(param_data, param_length);
+}
+
+void prepareWriteResult(uint8_t count)
+{
+  ctx.reset();
+}
+
+void prepareWriteRequest(uint8_t count)
+{
+  request.reset();
+}
+
+void prepareReadResult(uint8_t count)
+{
+  request.reset();
+  for (uint8_t i = 0; i < result_length; i++) {
+    request.writeResult(result_data[i]);
+  }
+}
+
+/**
+ * Print the result of a check and count failed checks.
+ */
+void check(uint8_t index, const __FlashStringHelper *name, bool ok)
+{
+  if (!ok) {
+    failed++;
+  }
+  Serial.print(codec_names[index]);
+  Serial.print('\t');
+  Serial.print(name);
+  Serial.print('\t');
+  Serial.println(ok ? F("ok") : F("FAILED"));
+}
+
+/**
+ * Check the encoders and decoders of a value type with its golden vector.
+ *
+ * @param index The index of the value type
+ * @param vector The golden vector in PROGMEM
+ * @return The golden vector of the next value type
+ */
+const uint8_t *checkGolden(uint8_t index, const uint8_t *vector)
+{
+  const bench_codec_t *codec = &codecs[index];
+  uint8_t expected[RPC_MAX_DATA_LENGTH];
+  uint8_t length;
+  uint32_t value;
+  uint8_t i;
+
+  value = 0;
+  for (i = 0; i < 4; i++) {
+    value = (value << 8) | pgm_read_byte(vector++);
+  }
+  length = pgm_read_byte(vector++);
+  memcpy_P(expected, vector, length);
+  vector += length;
+
+  // The golden value is used as first value of the batch
+  values[0] = value;
+  float_values[0] = toFloat(value);
+  encode(codec, 1);
+
+  check(index, F("golden request"), param_length == length && memcmp(param_data, expected, length) == 0);
+  check(index, F("golden result"), result_length == length + 1 && result_data[0] == codec_types[index] && memcmp(&result_data[1], expected, length) == 0);
+
+  memcpy(param_data, expected, length);
+  param_length = length;
+  prepareGetParam(1);
+  codec->getParam(1);
+  check(index, F("golden getParam"), codec->verify(1));
+  if (codec->readInline != NULL) {
+    codec->readInline(1);
+    check(index, F("golden inline"), codec->verify(1));
+  }
+
+  result_data[0] = codec_types[index];
+  memcpy(&result_data[1], expected, length);
+  result_length = length + 1;
+  if (codec->readResult != NULL) {
+    prepareReadResult(1);
+    codec->readResult(1);
+    check(index, F("golden read"), codec->verify(1) && request.getError() == 0);
+  }
+
+  return vector;
+}
+
+/**
+ * Run an operation BENCH_ROUNDS times and print the time per value.
+ *
+ * @param index The index of the value type
+ * @param name The name of the operation
+ * @param prepare Function called before every measurement, not measured
+ * @param run The function to measure
+ * @param bytes Number of encoded bytes processed by one measurement
+ */
+void bench(uint8_t index, const __FlashStringHelper *name, bench_function_t prepare, bench_function_t run, uint8_t bytes)
+{
+  uint32_t total = 0;
+  uint32_t ops = (uint32_t)BENCH_ROUNDS * BENCH_BATCH;
+  uint16_t round;
+  bool overflow = false;
+
+  for (round = 0; round < BENCH_ROUNDS; round++) {
+    prepare(BENCH_BATCH);
+#if BENCH_CYCLES == 1
+    noInterrupts();
+    TCCR1A = 0;
+    TCCR1B = 0;
+    TCNT1 = 0;
+    TIFR1 = _BV(TOV1);
+    TCCR1B = _BV(CS10);
+    run(BENCH_BATCH);
+    TCCR1B = 0;
+    total += TCNT1;
+    if (TIFR1 & _BV(TOV1)) {
+      overflow = true;
+    }
+    interrupts();
+#else
+    uint32_t start = micros();
+    run(BENCH_BATCH);
+    total += micros() - start;
+#endif
+  }
+
+  Serial.print(codec_names[index]);
+  Serial.print('\t');
+  Serial.print(name);
+  Serial.print('\t');
+#if BENCH_CYCLES == 1
+  // Counted cycles include the 2 cycles to stop the timer
+  Serial.print((float)total / ops);
+  Serial.print(F(" cycles/op\t"));
+  if (total > 0) {
+    Serial.print((float)bytes * BENCH_ROUNDS * F_CPU / total, 0);
+  }
+#else
+  Serial.print((float)total * 1000.0 / ops);
+  Serial.print(F(" ns/op\t"));
+  if (total > 0) {
+    Serial.print((float)bytes * BENCH_ROUNDS * 1000000.0 / total, 0);
+  }
+#endif
+  Serial.print(F(" bytes/s"));
+  if (overflow) {
+    Serial.print(F("\tTimer1 overflow, reduce BENCH_BATCH"));
+  }
+  Serial.println();
+}
+
+void setup()
+{
+  const uint8_t *vector = golden;
+  const bench_codec_t *codec;
+  uint8_t i;
+  uint8_t n;
+
+  Serial.begin(115200);
+  while (!Serial) {
+  }
+
+  request.setHandler(&connection);
+  connection.rpc = &request;
+
+  for (i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++) {
+    vector = checkGolden(i, vector);
+  }
+
+  // Values of different magnitude to get all lengths of the varints
+  for (n = 0; n < BENCH_BATCH; n++) {
+    values[n] = nextRandom() >> (nextRandom() & 0x1f);
+    float_values[n] = (int32_t)values[n] / 1000.0;
+  }
+
+  for (i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++) {
+    codec = &codecs[i];
+    encode(codec, BENCH_BATCH);
+
+    prepareGetParam(BENCH_BATCH);
+    codec->getParam(BENCH_BATCH);
+    check(i, F("random getParam"), codec->verify(BENCH_BATCH));
+    if (codec->readInline != NULL) {
+      codec->readInline(BENCH_BATCH);
+      check(i, F("random inline"), codec->verify(BENCH_BATCH));
+    }
+    if (codec->readResult != NULL) {
+      prepareReadResult(BENCH_BATCH);
+      codec->readResult(BENCH_BATCH);
+      check(i, F("random read"), codec->verify(BENCH_BATCH) && request.getError() == 0);
+    }
+
+    bench(i, F("getParam"), prepareGetParam, codec->getParam, param_length);
+    bench(i, F("result"), prepareWriteResult, codec->writeResult, result_length);
+    if (codec->readInline != NULL) {
+      bench(i, F("inline"), prepareNone, codec->readInline, param_length);
+    }
+    bench(i, F("request"), prepareWriteRequest, codec->writeRequest, param_length);
+    if (codec->readResult != NULL) {
+      bench(i, F("read"), prepareReadResult, codec->readResult, result_length);
+    }
+  }
+
+  Serial.print(F("failed checks: "));
+  Serial.println(failed);
+}
+
+void loop()
+{
+}
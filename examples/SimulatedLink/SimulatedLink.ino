@@ -0,0 +1,211 @@
+/**
+ * Arduino Remote Procedure Calls - ArduRPC
+ * Copyright (C) 2013-2016 DinoTools
+ *
+ * This file is part of ArduRPC.
+ *
+ * ArduRPC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * ArduRPC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Run a device (ArduRPC_Serial) and a client (ArduRPCRequest_Serial) on both
+ * ends of a simulated serial link.
+ *
+ * The example measures the calls per second with different baud rates and
+ * error rates and the time a blocking call needs to time out.
+ *
+ * Define RPC_VIRTUAL_CLOCK in ArduRPC.h to run the simulation faster than
+ * real time and with the same result on every run. Without it the example
+ * runs in real time.
+ *
+ * Open the serial monitor with 115200 baud to see the results.
+ */
+
+#include <ArduRPC.h>
+
+//! Simulated time of every measurement in milliseconds
+#define SIM_DURATION 10000
+//! Propagation delay of the link in microseconds
+#define SIM_LATENCY 100
+//! Length of the string sent with every call
+#define SIM_PAYLOAD 32
+
+/**
+ * Handler returning the string it has been called with.
+ */
+class EchoHandler : public ArduRPCHandler
+{
+  public:
+    EchoHandler()
+    {
+      this->type = 0x0000;
+    }
+    uint8_t call(ArduRPCContext *ctx, uint8_t cmd_id)
+    {
+      char buf[RPC_MAX_DATA_LENGTH];
+      uint8_t length;
+
+      if (cmd_id != 0x01) {
+        return RPC_RETURN_COMMAND_NOT_FOUND;
+      }
+      length = ctx->getParam_string(buf, sizeof(buf) - 1);
+      ctx->writeResult_string(buf, length);
+      return RPC_RETURN_SUCCESS;
+    }
+};
+
+ArduRPC rpc = ArduRPC(2, 0);
+EchoHandler echo;
+ArduRPCRequest request;
+char payload[SIM_PAYLOAD + 1];
+
+//! Port and processor of the device while a simulation is running
+Stream *device_port;
+ArduRPC_Serial *device;
+
+/**
+ * Process all bytes received by the device.
+ */
+void runDevice(void *arg)
+{
+  while (device_port->available() > 0) {
+    device->readData();
+  }
+}
+
+/**
+ * Advance the virtual clock.
+ *
+ * @param us Microseconds to advance
+ */
+void tick(uint32_t us)
+{
+#ifdef RPC_VIRTUAL_CLOCK
+  rpc_clock_advance(us);
+#endif
+}
+
+/**
+ * Send requests without blocking and count the results.
+ *
+ * @param baud The baud rate
+ * @param loss_rate Lost bytes per 65536 bytes
+ * @param corruption_rate Corrupted bytes per 65536 bytes
+ */
+void measureCalls(uint32_t baud, uint16_t loss_rate, uint16_t corruption_rate)
+{
+  ArduRPC_SimLink link(baud, SIM_LATENCY);
+  ArduRPC_Serial device_serial(link.a, rpc);
+  ArduRPCRequest_Serial client(request, link.b);
+  uint32_t start;
+  uint32_t calls = 0;
+  uint32_t errors = 0;
+  uint8_t state;
+
+  link.setErrorRates(loss_rate, corruption_rate);
+  device_port = &link.a;
+  device = &device_serial;
+  client.timeout = 1000;
+
+  start = RPC_MILLIS();
+  while (RPC_MILLIS() - start < SIM_DURATION) {
+    request.reset();
+    request.writeRequest_string(payload);
+    request.send(0x00, 0x01);
+    do {
+      runDevice(NULL);
+      state = request.poll();
+      tick(10);
+    } while (state == RPC_REQUEST_STATE_PENDING);
+
+    if (state == RPC_REQUEST_STATE_DONE && request.return_code == RPC_RETURN_SUCCESS) {
+      calls++;
+    } else {
+      errors++;
+    }
+  }
+
+  Serial.print(baud);
+  Serial.print(F(" baud, loss "));
+  Serial.print(loss_rate);
+  Serial.print(F(", corruption "));
+  Serial.print(corruption_rate);
+  Serial.print(F(": "));
+  Serial.print(calls * 1000.0 / SIM_DURATION);
+  Serial.print(F(" calls/s, "));
+  Serial.print(errors);
+  Serial.print(F(" errors, "));
+  Serial.print((link.a.getStats()->sent + link.b.getStats()->sent) * 1000.0 / SIM_DURATION, 0);
+  Serial.print(F(" bytes/s, "));
+  Serial.print(link.a.getStats()->overflows + link.b.getStats()->overflows);
+  Serial.println(F(" overflows"));
+}
+
+/**
+ * Measure the time of a blocking call.
+ *
+ * @param baud The baud rate
+ * @param run_device Run the device while waiting for the result
+ */
+void measureBlockingCall(uint32_t baud, bool run_device)
+{
+  ArduRPC_SimLink link(baud, SIM_LATENCY);
+  ArduRPC_Serial device_serial(link.a, rpc);
+  ArduRPCRequest_Serial client(request, link.b);
+  uint32_t start;
+  bool res;
+
+  device_port = &link.a;
+  device = &device_serial;
+  client.timeout = 1000;
+  if (run_device) {
+    rpc_set_idle_callback(runDevice, NULL);
+  }
+
+  request.reset();
+  request.writeRequest_string(payload);
+  start = RPC_MILLIS();
+  res = request.call(0x00, 0x01);
+  rpc_set_idle_callback(NULL, NULL);
+
+  Serial.print(baud);
+  Serial.print(run_device ? F(" baud, device running: ") : F(" baud, device stopped: "));
+  Serial.print(res ? F("result after ") : F("timeout after "));
+  Serial.print(RPC_MILLIS() - start);
+  Serial.println(F(" ms"));
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  while (!Serial) {
+  }
+
+  memset(payload, 'x', SIM_PAYLOAD);
+  payload[SIM_PAYLOAD] = '\0';
+  rpc.connectHandler(&echo);
+
+  measureCalls(9600, 0, 0);
+  measureCalls(115200, 0, 0);
+  measureCalls(1000000, 0, 0);
+  measureCalls(115200, 64, 0);
+  measureCalls(115200, 0, 64);
+
+  measureBlockingCall(9600, true);
+  measureBlockingCall(9600, false);
+}
+
+void loop()
+{
+}
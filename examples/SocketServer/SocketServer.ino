@@ -0,0 +1,66 @@
+/**
+ * Arduino Remote Procedure Calls - ArduRPC
+ * Copyright (C) 2013-2016 DinoTools
+ *
+ * This file is part of ArduRPC.
+ *
+ * ArduRPC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * ArduRPC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Serve ArduRPC on a TCP port and a Unix domain socket of a Linux host.
+ *
+ * The example runs on a host implementation of the Arduino core, e.g. the one
+ * of a simulator. Set RPC_NETWORK to 0 in ArduRPC.h if the core does not
+ * provide Client.h.
+ *
+ * Measure the latency and the throughput with the load generator:
+ *
+ *   tools/ardurpc-loadgen.py --host 127.0.0.1:1234 --clients 16 --idle 5000
+ *   tools/ardurpc-loadgen.py --unix /tmp/ardurpc.sock --clients 16
+ */
+
+#include <ArduRPC.h>
+
+#if !defined(__linux__)
+#error "ArduRPC_Socket is only available on Linux"
+#endif
+
+//! TCP port on the loopback interface
+#define SERVER_PORT 1234
+//! Path of the Unix domain socket
+#define SERVER_PATH "/tmp/ardurpc.sock"
+//! Maximum number of connections
+#define SERVER_MAX_CONNECTIONS 20000
+
+ArduRPC rpc = ArduRPC(2, 0);
+ArduRPC_Socket server(rpc, SERVER_MAX_CONNECTIONS);
+
+void setup()
+{
+  Serial.begin(115200);
+
+  if (!server.listenTCP(SERVER_PORT)) {
+    Serial.println(F("Unable to listen on the TCP port"));
+  }
+  if (!server.listenUnix(SERVER_PATH)) {
+    Serial.println(F("Unable to listen on the Unix domain socket"));
+  }
+}
+
+void loop()
+{
+  // Wait at most 100 ms for an event
+  server.poll(100);
+}
@@ -25,50 +25,84 @@
  *   - Allocate memory for the handler and function list
  *   - Reset all counters
  *   - Set rpc information
+ *   - Allocate the buffers of the default context
+ *   - Allocate the buffers for the precomputed system responses
  *
- * The number of handlers and functions must not exceed the given number.
+ * The number of handlers, functions and subscriptions must not exceed the given number.
  * It's not possible to increase the limits.
  *
  * @param handler_count Maximum number of handlers
  * @param function_count Maximum number of functions
+ * @param subscription_count Maximum number of subscriptions
  */
-ArduRPC::ArduRPC(uint8_t handler_count, uint8_t function_count)
+ArduRPC::ArduRPC(uint8_t handler_count, uint8_t function_count, uint8_t subscription_count)
 {
   uint8_t i;
   rpc_handler_t handler;
 
   this->handlers = (rpc_handler_t *)malloc(sizeof(rpc_handler_t) * handler_count);
 
+  this->handler_infos = (rpc_handler_info_t *)malloc(sizeof(rpc_handler_info_t) * handler_count);
   handler = {0xffff, NULL};
   for(i = 0; i < handler_count; i++) {
     handlers[i] = handler;
+    this->handler_infos[i].name[0] = '\0';
   }
   this->functions = (rpc_function_t *)malloc(sizeof(rpc_function_t) * function_count);
-  this->handler_infos = (rpc_handler_info_t *)malloc(sizeof(rpc_handler_info_t) * handler_count);
-  this->handler_index = 0;
   this->function_index = 0;
   this->max_handler_count = handler_count;
   this->max_function_count = function_count;
-  this->data.data = (uint8_t *)malloc(RPC_MAX_DATA_LENGTH);
-#if RPC_SHARED_BUFFERS == 1
-  this->result.data = this->data.data;
-#else
-  this->result.data = (uint8_t *)malloc(RPC_MAX_RESULT_LENGTH);
+  this->subscriptions = (rpc_subscription_t *)malloc(sizeof(rpc_subscription_t) * subscription_count);
+  for(i = 0; i < subscription_count; i++) {
+    this->subscriptions[i].state = RPC_SUBSCRIPTION_STATE_FREE;
+  }
+  this->max_subscription_count = subscription_count;
+  this->subscription_index = 0;
+  this->function_list_cache = (uint8_t *)malloc(5 + 2 * function_count);
+  this->handler_list_cache = (uint8_t *)malloc(5 + 3 * handler_count);
+  this->generation = 0;
+  this->updateSystemCache();
+  this->peak_data_length = 0;
+  this->peak_result_length = 0;
+  this->overflow_count = 0;
+#if RPC_STATS_SIZE > 0
+  this->systemResetStats(NULL);
+#endif
+#if RPC_TRACE_SIZE > 0
+  this->trace_index = 0;
+  this->trace_count = 0;
 #endif
+  this->_context = NULL;
 }
 
 /**
  * Connect a function to the RPC processor.
+ * The first free slot is used. Slots of disconnected functions are reused.
  * @param function All information to call the function.
- * @return The internal function index
+ * @return The internal function index or 0xff if all slots are in use
  */
 uint8_t ArduRPC::connectFunction(rpc_function_t function)
 {
-  if(this->function_index >= this->max_function_count - 1) {
+  uint8_t i;
+
+  if(function.callback == NULL) {
     return 0xff;
   }
-  this->functions[this->function_index] = function;
-  return this->function_index++;
+
+  for(i = 0; i < this->function_index; i++) {
+    if(this->functions[i].callback == NULL) {
+      break;
+    }
+  }
+  if(i >= this->max_function_count) {
+    return 0xff;
+  }
+  this->functions[i] = function;
+  if(i == this->function_index) {
+    this->function_index++;
+  }
+  this->updateSystemCache();
+  return i;
 }
 
 /**
@@ -81,48 +115,51 @@ uint8_t ArduRPC::connectFunction(rpc_function_t function)
  */
 uint8_t ArduRPC::connectFunction(uint8_t type, void *callback, void *arguments)
 {
-  rpc_function_t function = {type, callback, arguments};
+  rpc_function_t function = {type, callback, arguments, 0};
+  return connectFunction(function);
+}
+
+/**
+ * Connect a function with its own request context to the RPC processor.
+ * The callback must use the given context to read the parameters and write the result.
+ * @param type The type of the function. Have a look at the type list in the documentation.
+ * @param callback The callback function to call
+ * @param arguments A pointer to the arguments. It is passed to the callback function
+ * @return The internal function index
+ */
+uint8_t ArduRPC::connectFunction(uint8_t type, rpc_context_callback_function_t callback, void *arguments)
+{
+  rpc_function_t function = {type, (void *)callback, arguments, RPC_FUNCTION_FLAG_CONTEXT};
   return connectFunction(function);
 }
 
 /**
  * Connect a handler to the RPC processor.
+ * The first free slot is used. Slots of disconnected handlers are reused.
  * @param handler All information to call the handler.
- * @return The internal handler index.
+ * @return The internal handler index or 0xff if all slots are in use
  */
 uint8_t ArduRPC::connectHandler(rpc_handler_t handler)
 {
   uint8_t i;
 
-  if(this->handler_index >= this->max_handler_count - 1) {
-    return 0xff;
-  }
-
-  for(i = this->handler_index; i < this->max_handler_count; i++) {
-    this->handler_index = i;
+  for(i = 0; i < this->max_handler_count; i++) {
     if(this->handlers[i].handler == NULL) {
-      break;
+      return this->connectHandler(handler, i);
     }
   }
-
-  if(this->handler_index >= this->max_handler_count - 1) {
-    return 0xff;
-  }
-  handlers[this->handler_index] = handler;
-  return this->handler_index++;
+  return 0xff;
 }
 
 /**
  * Connect a handler to the RPC processor.
  * @param handler All information to call the handler.
  * @param handler_id The ID of the handler
- * @return The internal handler index.
+ * @return The internal handler index or 0xff if the ID is invalid or in use
  */
 uint8_t ArduRPC::connectHandler(rpc_handler_t handler, uint8_t handler_id)
 {
-  uint8_t i;
-
-  if(handler_id >= this->max_handler_count - 1) {
+  if(handler.handler == NULL || handler_id >= this->max_handler_count) {
     return 0xff;
   }
 
@@ -131,6 +168,7 @@ uint8_t ArduRPC::connectHandler(rpc_handler_t handler, uint8_t handler_id)
   }
 
   handlers[handler_id] = handler;
+  this->updateSystemCache();
   return handler_id;
 }
 
@@ -164,343 +202,652 @@ uint8_t ArduRPC::connectHandler(void *handler, uint8_t handler_id)
 }
 
 /**
- * Copy external data into the internal processing buffer
- * @param src A pointer to the data to copy.
- * @param len Number of bytes to copy
- * @return 0 on success.
+ * Disconnect a function from the RPC processor.
+ * Subscriptions and statistics of the function are removed. The ID is
+ * reused by the next function connected.
+ * @param function_id The internal function index
+ * @return The function index or 0xff if no function is connected with the ID
+ */
+uint8_t ArduRPC::disconnectFunction(uint8_t function_id)
+{
+  if(function_id >= this->function_index || this->functions[function_id].callback == NULL) {
+    return 0xff;
+  }
+  this->functions[function_id].callback = NULL;
+  // Shrink the list if the last slots are free
+  while(this->function_index > 0 && this->functions[this->function_index - 1].callback == NULL) {
+    this->function_index--;
+  }
+  this->removeSubscriptions(0xfe, function_id);
+#if RPC_STATS_SIZE > 0
+  this->removeStats(0xfe, function_id);
+#endif
+  this->updateSystemCache();
+  return function_id;
+}
+
+/**
+ * Disconnect a handler from the RPC processor.
+ * The name, subscriptions and statistics of the handler are removed. The ID
+ * is free to be used by the next handler connected.
+ * @param handler_id The internal handler index
+ * @return The handler index or 0xff if no handler is connected with the ID
+ */
+uint8_t ArduRPC::disconnectHandler(uint8_t handler_id)
+{
+  rpc_handler_t handler = {0xffff, NULL};
+
+  if(handler_id >= this->max_handler_count || this->handlers[handler_id].handler == NULL) {
+    return 0xff;
+  }
+  this->handlers[handler_id] = handler;
+  this->handler_infos[handler_id].name[0] = '\0';
+  this->removeSubscriptions(handler_id, -1);
+#if RPC_STATS_SIZE > 0
+  this->removeStats(handler_id, -1);
+#endif
+  this->updateSystemCache();
+  return handler_id;
+}
+
+/**
+ * Replace a connected handler without changing its ID and name.
+ * Subscriptions and statistics are removed if the type of the new handler
+ * differs from the type of the old one.
+ * @param handler Pointer to the handler class.
+ * @param handler_id The internal handler index
+ * @return The handler index or 0xff if no handler is connected with the ID
+ */
+uint8_t ArduRPC::replaceHandler(void *handler, uint8_t handler_id)
+{
+  // Type cast
+  ArduRPCHandler *h = (ArduRPCHandler *)handler;
+
+  if(handler == NULL || handler_id >= this->max_handler_count || this->handlers[handler_id].handler == NULL) {
+    return 0xff;
+  }
+  if(this->handlers[handler_id].type != h->type) {
+    this->removeSubscriptions(handler_id, -1);
+#if RPC_STATS_SIZE > 0
+    this->removeStats(handler_id, -1);
+#endif
+  }
+  h->setRPC(this);
+  this->handlers[handler_id].type = h->type;
+  this->handlers[handler_id].handler = handler;
+  this->updateSystemCache();
+  return handler_id;
+}
+
+/**
+ * Copy external data into the processing buffer of the current context.
+ * @see ArduRPCContext::copyData()
  */
 uint8_t ArduRPC::copyData(uint8_t *src, uint8_t len)
 {
-  this->data.length = len;
-  memcpy(this->data.data, src, len);
-  return 0;
+  return this->getContext()->copyData(src, len);
 }
 
 /**
- * Read a character from the current position in the parameter data and return it.
- * @return A character from the parameter data.
+ * Return the context of the request currently processed.
+ *
+ * If no request is processed the default context is returned.
+ *
+ * @return Pointer to the context.
  */
-char ArduRPC::getParam_char()
+ArduRPCContext *ArduRPC::getContext()
 {
-  char res = rpc_read_int8(&this->data.data[this->cur_data_read_pos]);
-  this->cur_data_read_pos++;
-  return res;
+  if (this->_context == NULL) {
+    return &this->default_context;
+  }
+  return this->_context;
 }
 
 /**
- * Read a float value at the current position in the parameter data and return it.
+ * Return the generation of the handler and function lists.
+ *
+ * The generation is incremented every time a handler or function is
+ * connected, disconnected or renamed. Clients compare it with the generation
+ * of their cached lists to detect changes.
  *
- * @return A float value.
+ * @return The generation
  */
-float ArduRPC::getParam_float()
+uint16_t ArduRPC::getGeneration()
 {
-  float result;
-  uint8_t *v = (uint8_t *)&result;
+  return this->generation;
+}
 
-  v[3] = this->getParam_uint8();
-  v[2] = this->getParam_uint8();
-  v[1] = this->getParam_uint8();
-  v[0] = this->getParam_uint8();
+/**
+ * Return the fingerprint of the device.
+ *
+ * The fingerprint is a hash of the library version, the types and names of
+ * the handlers and the function list. Unlike the generation it is the same
+ * after a restart if nothing has been changed.
+ *
+ * @return The fingerprint, never 0
+ */
+uint32_t ArduRPC::getFingerprint()
+{
+  return this->fingerprint;
+}
 
-  return result;
+/**
+ * @see ArduRPCContext::getParam_char()
+ */
+char ArduRPC::getParam_char()
+{
+  return this->getContext()->getParam_char();
 }
 
 /**
- * Read a byte from the current position in the parameter data and return it.
+ * @see ArduRPCContext::getParam_float()
+ */
+float ArduRPC::getParam_float()
+{
+  return this->getContext()->getParam_float();
+}
+
+/**
+ * @see ArduRPCContext::getParam_int8()
  */
 int8_t ArduRPC::getParam_int8()
 {
-  int8_t res = rpc_read_int8(&this->data.data[this->cur_data_read_pos]);
-  this->cur_data_read_pos++;
-  return res;
+  return this->getContext()->getParam_int8();
 }
 
 /**
- * Read two bytes from the current position in the parameter data and return it.
+ * @see ArduRPCContext::getParam_int16()
  */
 int16_t ArduRPC::getParam_int16()
 {
-  int16_t res;
-  res = rpc_read_int16(&this->data.data[this->cur_data_read_pos]);
-  this->cur_data_read_pos += 2;
-  return res;
+  return this->getContext()->getParam_int16();
 }
 
 /**
- * Read four bytes from the current position in the parameter data and return it.
+ * @see ArduRPCContext::getParam_int32()
  */
 int32_t ArduRPC::getParam_int32()
 {
-  int16_t res;
-  res = rpc_read_int32(&this->data.data[this->cur_data_read_pos]);
-  this->cur_data_read_pos += 4;
-  return res;
+  return this->getContext()->getParam_int32();
 }
 
 /**
- * Read a string from the current position in the parameter data.
- * @param dst Pointer to the destination.
- * @param max_length The maximum number of bytes to copy.
- * @return The number of copyed bytes.
+ * @see ArduRPCContext::getParam_string()
  */
 uint8_t ArduRPC::getParam_string(char *dst, uint8_t max_length)
 {
-  uint8_t length;
-  uint8_t n;
-  n = length = this->getParam_uint8();
-  if(n > max_length) {
-    n = max_length;
-  }
-  memcpy(dst, &this->data.data[this->cur_data_read_pos], n);
-  if(n < max_length) {
-    dst[n] = '\0';
-  }
-  this->cur_data_read_pos += length;
-  return n;
+  return this->getContext()->getParam_string(dst, max_length);
 }
 
 /**
- * Read a byte from the current position in the parameter data and return it.
+ * @see ArduRPCContext::getParam_uint8()
  */
 uint8_t ArduRPC::getParam_uint8()
 {
-  uint8_t res = rpc_read_uint8(&this->data.data[this->cur_data_read_pos]);
-  this->cur_data_read_pos++;
-  return res;
+  return this->getContext()->getParam_uint8();
 }
 
 /**
- * Read two bytes from the current position in the parameter data and return it.
+ * @see ArduRPCContext::getParam_uint16()
  */
 uint16_t ArduRPC::getParam_uint16()
 {
-  uint16_t res;
-  res = rpc_read_uint16(&this->data.data[this->cur_data_read_pos]);
-  this->cur_data_read_pos += 2;
-  return res;
+  return this->getContext()->getParam_uint16();
 }
 
 /**
- * Read four bytes from the current position in the parameter data and return it.
+ * @see ArduRPCContext::getParam_uint32()
  */
 uint32_t ArduRPC::getParam_uint32()
 {
-  uint32_t res;
-  res = rpc_read_uint32(&this->data.data[this->cur_data_read_pos]);
-  this->cur_data_read_pos += 4;
-  return res;
+  return this->getContext()->getParam_uint32();
 }
 
 /**
- * Return pointer to raw data structure.
- *
- * @return Pointer to raw data.
+ * @see ArduRPCContext::getParam_varint()
+ */
+int32_t ArduRPC::getParam_varint()
+{
+  return this->getContext()->getParam_varint();
+}
+
+/**
+ * @see ArduRPCContext::getParam_varuint()
+ */
+uint32_t ArduRPC::getParam_varuint()
+{
+  return this->getContext()->getParam_varuint();
+}
+
+/**
+ * @see ArduRPCContext::getRawData()
  */
 rpc_data_t *ArduRPC::getRawData()
 {
-  return &this->data;
+  return this->getContext()->getRawData();
 }
 
 /**
- * Return pointer to raw result data.
- *
- * @return Pointer to raw result data.
+ * @see ArduRPCContext::getRawResult()
  */
 rpc_result_t *ArduRPC::getRawResult()
 {
-  return &this->result;
+  return this->getContext()->getRawResult();
 }
 
 /**
- * Return the length of request parameters in bytes
- *
- * @return Parameter length
+ * @see ArduRPCContext::getRequestParamLength()
  */
 uint8_t ArduRPC::getRequestParamLength()
 {
-  // The size of the header is 4 bytes
-  return this->data.length - 4;
+  return this->getContext()->getRequestParamLength();
 }
 
 /**
- * Return a pointer to the result data
- * @return A pointer to the result data
+ * @see ArduRPCContext::getResultData()
  */
 uint8_t *ArduRPC::getResultData()
 {
-  return (uint8_t *)this->result.data;
+  return this->getContext()->getResultData();
 }
 
 /**
- * Get the length of the result data including the header.
- * @return The number of bytes of the result data
+ * @see ArduRPCContext::getResultLength()
  */
 uint8_t ArduRPC::getResultLength()
 {
-  return this->result.length + 1;
+  return this->getContext()->getResultLength();
 }
 
 /**
- * Get the length of the result data.
- * @return The number of bytes of the result data
+ * @see ArduRPCContext::getResultDataLength()
  */
 uint8_t ArduRPC::getResultDataLength()
 {
-  return this->result.length;
+  return this->getContext()->getResultDataLength();
 }
 
+/**
+ * Precomputed response of the system command getProtocolVersion (0x01)
+ */
+static const uint8_t rpc_system_protocol_version[] PROGMEM = {
+  RPC_UINT8, 0
+};
+
+/**
+ * Precomputed response of the system command getLibraryVersion (0x02)
+ */
+static const uint8_t rpc_system_library_version[] PROGMEM = {
+  RPC_ARRAY, RPC_UINT8, 3, RPC_VERSION_MAJOR, RPC_VERSION_MINOR, RPC_VERSION_PATCH
+};
+
+/**
+ * Precomputed response of the system command getMaxPacketSize (0x03)
+ */
+static const uint8_t rpc_system_max_packet_size[] PROGMEM = {
+  RPC_UINT16, (RPC_MAX_DATA_LENGTH >> 8) & 0xff, RPC_MAX_DATA_LENGTH & 0xff
+};
+
+/**
+ * Table of all system commands sorted by the command ID.
+ *
+ * Commands with a constant result are answered with the precomputed response.
+ */
+const rpc_system_call_t ArduRPC::system_calls[] PROGMEM = {
+  {0x01, rpc_system_protocol_version, sizeof(rpc_system_protocol_version), NULL},
+  {0x02, rpc_system_library_version, sizeof(rpc_system_library_version), NULL},
+  {0x03, rpc_system_max_packet_size, sizeof(rpc_system_max_packet_size), NULL},
+  {0x04, NULL, 0, &ArduRPC::systemGetGeneration},
+  {0x05, NULL, 0, &ArduRPC::systemGetFingerprint},
+  {0x10, NULL, 0, &ArduRPC::systemGetFunctionList},
+  {0x20, NULL, 0, &ArduRPC::systemGetHandlerList},
+  {0x21, NULL, 0, &ArduRPC::systemGetHandlerName},
+  {0x30, NULL, 0, &ArduRPC::systemSubscribe},
+  {0x31, NULL, 0, &ArduRPC::systemUnsubscribe},
+#if RPC_STATS_SIZE > 0
+  {0x40, NULL, 0, &ArduRPC::systemGetStats},
+  {0x41, NULL, 0, &ArduRPC::systemResetStats},
+#endif
+#if RPC_TRACE_SIZE > 0
+  {0x42, NULL, 0, &ArduRPC::systemGetTrace},
+#endif
+  {0x43, NULL, 0, &ArduRPC::systemGetMemoryInfo},
+};
+
 /**
  * Handle all system calls.
+ * @param ctx The context of the request.
  * @param cmd_id The ID of the called command.
  * @return The result of the command.
  */
-uint8_t ArduRPC::handleSystemCalls(uint8_t cmd_id)
+uint8_t ArduRPC::handleSystemCalls(ArduRPCContext *ctx, uint8_t cmd_id)
 {
   uint8_t i;
-  uint16_t handler_type;
-  uint8_t handler_id;
+  rpc_system_call_t system_call;
 
-  if (cmd_id == 0x01) {
-    // get protocol version
-    this->writeResult(RPC_UINT8);
-    this->writeResult(0);
-    return RPC_RETURN_SUCCESS;
-  } else if (cmd_id == 0x02) {
-    // get library version
-    this->writeResult(RPC_ARRAY);
-    this->writeResult(RPC_UINT8);
-    this->writeResult(3);
-    this->writeResult(RPC_VERSION_MAJOR);
-    this->writeResult(RPC_VERSION_MINOR);
-    this->writeResult(RPC_VERSION_PATCH);
-    return RPC_RETURN_SUCCESS;
-  } else if (cmd_id == 0x03) {
-    this->writeResult_uint16(RPC_MAX_DATA_LENGTH);
-    return RPC_RETURN_SUCCESS;
-  } else if (cmd_id == 0x10) {
-    this->writeResult(RPC_MCARRAY);
-    this->writeResult(2);
-    this->writeResult(RPC_UINT8);
-    this->writeResult(RPC_UINT8);
-    this->writeResult(function_index);
-    for (i = 0; i < function_index; i++) {
-      this->writeResult(i);
-      this->writeResult(this->functions[i].type);
+  for (i = 0; i < sizeof(system_calls) / sizeof(system_calls[0]); i++) {
+    memcpy_P(&system_call, &system_calls[i], sizeof(system_call));
+    if (system_call.cmd_id < cmd_id) {
+      continue;
     }
-    return RPC_RETURN_SUCCESS;
-  } else if (cmd_id == 0x20) {
-    this->writeResult(RPC_MCARRAY);
-    this->writeResult(2);
-    this->writeResult(RPC_UINT8);
-    this->writeResult(RPC_UINT16);
-    this->writeResult(handler_index);
-    for (i = 0; i < handler_index; i++) {
-      handler_type = this->handlers[i].type;
-      this->writeResult(i);
-      this->writeResult((((handler_type) >> 8) & 0xff));
-      this->writeResult(((handler_type) & 0xff));
+    if (system_call.cmd_id > cmd_id) {
+      break;
     }
-    return RPC_RETURN_SUCCESS;
-  } else if (cmd_id == 0x21) {
-    handler_id = this->getParam_int8();
-    if (handler_id < this->max_handler_count) {
-      this->writeResult(RPC_STRING);
-      this->writeResult(RPC_MAX_NAME_LENGTH);
-      this->writeResult(this->handler_infos[handler_id].name, RPC_MAX_NAME_LENGTH);
+    if (system_call.call != NULL) {
+      return (this->*system_call.call)(ctx);
     }
+    ctx->writeResult_P(system_call.response, system_call.response_length);
     return RPC_RETURN_SUCCESS;
   }
   return RPC_RETURN_COMMAND_NOT_FOUND;
 }
 
 /**
- * Process the data in the internal processing buffer.
+ * Execute the next subscribed command that is due.
+ *
+ * The command is executed with the given context. If a notification must be
+ * sent the result is left in the context and the ID of the subscription is
+ * returned. At most one notification is generated per call.
+ *
+ * A notification is sent on the first execution and every time the value
+ * has changed by at least the threshold of the subscription. A threshold of
+ * 0 sends a notification on every execution. Results that are not a single
+ * number are compared by a checksum. The interval only limits how often the
+ * command is executed, no notification is sent just because it has elapsed.
+ *
+ * @param ctx The context to use. Its content is overwritten.
+ * @return The ID of the subscription or 0xff if no notification must be sent
+ */
+uint8_t ArduRPC::pollSubscriptions(ArduRPCContext *ctx)
+{
+  uint8_t i;
+  uint8_t j;
+  uint8_t n;
+  uint8_t *data;
+  float value;
+  bool numeric;
+  rpc_subscription_t *subscription;
+
+  for (n = 0; n < this->max_subscription_count; n++) {
+    i = this->subscription_index;
+    this->subscription_index++;
+    if (this->subscription_index >= this->max_subscription_count) {
+      this->subscription_index = 0;
+    }
+
+    subscription = &this->subscriptions[i];
+    if (subscription->state == RPC_SUBSCRIPTION_STATE_FREE) {
+      continue;
+    }
+    if (subscription->state == RPC_SUBSCRIPTION_STATE_NOTIFIED &&
+        RPC_MILLIS() - subscription->last_time < subscription->interval) {
+      continue;
+    }
+    subscription->last_time = RPC_MILLIS();
+
+    ctx->reset();
+    ctx->writeData(0x00);
+    ctx->writeData(subscription->handler_id);
+    ctx->writeData(subscription->command_id);
+    ctx->writeData(subscription->param_length);
+    for (j = 0; j < subscription->param_length; j++) {
+      ctx->writeData(subscription->params[j]);
+    }
+    this->process(ctx);
+
+    // The value of a single number or a checksum for all other results
+    data = ctx->getResultData();
+    value = 0;
+    numeric = false;
+    if (data[0] == RPC_RETURN_SUCCESS && ctx->getResultDataLength() > 0 &&
+        ctx->getResultDataLength() >= 1 + rpc_type_size(data[1])) {
+      numeric = true;
+      if (data[1] == RPC_FLOAT) {
+        uint8_t *v = (uint8_t *)&value;
+        v[3] = data[2];
+        v[2] = data[3];
+        v[1] = data[4];
+        v[0] = data[5];
+      } else if (data[1] == RPC_INT8) {
+        value = rpc_read_int8(&data[2]);
+      } else if (data[1] == RPC_UINT8) {
+        value = rpc_read_uint8(&data[2]);
+      } else if (data[1] == RPC_INT16) {
+        value = rpc_read_int16(&data[2]);
+      } else if (data[1] == RPC_UINT16) {
+        value = rpc_read_uint16(&data[2]);
+      } else if (data[1] == RPC_INT32) {
+        value = rpc_read_int32(&data[2]);
+      } else if (data[1] == RPC_UINT32) {
+        value = rpc_read_uint32(&data[2]);
+      } else {
+        numeric = false;
+      }
+    }
+    if (!numeric) {
+      uint16_t checksum = 0;
+      for (j = 0; j < ctx->getResultLength(); j++) {
+        checksum = (checksum << 1 | checksum >> 15) + data[j];
+      }
+      value = checksum;
+    }
+
+    if (subscription->state == RPC_SUBSCRIPTION_STATE_NOTIFIED && subscription->threshold != 0) {
+      if (!numeric && value == subscription->last_value) {
+        continue;
+      }
+      if (numeric &&
+          value - subscription->last_value < subscription->threshold &&
+          subscription->last_value - value < subscription->threshold) {
+        continue;
+      }
+    }
+
+    subscription->state = RPC_SUBSCRIPTION_STATE_NOTIFIED;
+    subscription->last_value = value;
+    return i;
+  }
+  return 0xff;
+}
+
+/**
+ * Process the data in the processing buffer of the default context.
+ * @see process(ArduRPCContext *ctx)
+ */
+void ArduRPC::process()
+{
+  this->process(&this->default_context);
+}
+
+/**
+ * Process the data in the processing buffer of the given context.
  *   -# Check if the protocol version is supported.
  *   -# Extract the handler ID.
  *   -# Extract the command ID.
  *   -# Extract the length of the parameter data.
  *   -# Call the requested handler and function.
+ *
+ * The given context is used as current context while the request is processed.
+ * This keeps handlers using the getParam_*() and writeResult_*() functions of
+ * ArduRPC working.
+ *
+ * @param ctx The context with the request data. The result is written to it.
  */
-void ArduRPC::process()
+void ArduRPC::process(ArduRPCContext *ctx)
 {
   uint8_t raw_data_length;
+  ArduRPCContext *prev_context;
 
   // reset result
-  this->result.length = 0;
+  ctx->getRawResult()->length = 0;
 
-  raw_data_length = this->data.length;
+  raw_data_length = ctx->getRawData()->length;
+  if (raw_data_length > this->peak_data_length) {
+    this->peak_data_length = raw_data_length;
+  }
+
+  // the request has been truncated
+  if (this->countOverflows(ctx)) {
+    ctx->setReturnCode(RPC_RETURN_INVALID_REQUEST);
+    ctx->writeResult(RPC_NONE);
+    return;
+  }
 
   // check for min packet size
   if (raw_data_length < 4) {
-    this->setReturnCode(RPC_RETURN_INVALID_HEADER);
-    this->writeResult(RPC_NONE);
+    ctx->setReturnCode(RPC_RETURN_INVALID_HEADER);
+    ctx->writeResult(RPC_NONE);
     return;
   }
 
   // protocol version
-  if (this->getParam_uint8() != 0x00) {
+  if (ctx->getParam_uint8() != 0x00) {
     return;
   }
 
-  uint8_t handler_id = this->getParam_uint8();
-  uint8_t command_id = this->getParam_uint8();
-  uint8_t length = this->getParam_uint8();
+  uint8_t handler_id = ctx->getParam_uint8();
+  uint8_t command_id = ctx->getParam_uint8();
+  uint8_t length = ctx->getParam_uint8();
   uint8_t res = RPC_RETURN_FAILURE;
 
   if (length != raw_data_length - 4) {
-    this->setReturnCode(RPC_RETURN_INVALID_REQUEST);
-    this->writeResult(RPC_NONE);
+    ctx->setReturnCode(RPC_RETURN_INVALID_REQUEST);
+    ctx->writeResult(RPC_NONE);
     return;
   }
 
+  prev_context = this->_context;
+  this->_context = ctx;
+
+#if RPC_STATS_SIZE > 0 || RPC_TRACE_SIZE > 0
+  uint32_t time_start = RPC_MICROS();
+#endif
+
   if(handler_id < this->max_handler_count) {
     rpc_handler_t *handler;
     handler = &handlers[handler_id];
     if(handler->handler != NULL) {
       ArduRPCHandler *h = (ArduRPCHandler *)handler->handler;
-      res = h->call(command_id);
+      res = h->call(ctx, command_id);
     } else {
       res = RPC_RETURN_HANDLER_NOT_FOUND;
     }
   } else if (handler_id == 0xfe) {
-    if (command_id >= this->function_index) {
+    if (command_id >= this->function_index || functions[command_id].callback == NULL) {
       res = RPC_RETURN_FUNCTION_NOT_FOUND;
     } else {
       rpc_function_t *function;
-      function = &functions[handler_id];
-      rpc_callback_function_t callback_function = (rpc_callback_function_t)function->callback;
-      res = callback_function(this, function->arguments);
+      function = &functions[command_id];
+      if (function->flags & RPC_FUNCTION_FLAG_CONTEXT) {
+        rpc_context_callback_function_t callback_function = (rpc_context_callback_function_t)function->callback;
+        res = callback_function(ctx, function->arguments);
+      } else {
+        rpc_callback_function_t callback_function = (rpc_callback_function_t)function->callback;
+        res = callback_function(this, function->arguments);
+      }
     }
   } else if (handler_id == 0xff) {
-    res = this->handleSystemCalls(command_id);
+    res = this->handleSystemCalls(ctx, command_id);
   } else {
     res = RPC_RETURN_HANDLER_NOT_FOUND;
   }
 
-  this->setReturnCode(res);
-  if (this->getResultDataLength() == 0) {
-    this->writeResult(RPC_NONE);
+  // the transport can not wait for the request to be completed
+  if (res == RPC_RETURN_PENDING && !ctx->isPendingAllowed()) {
+    res = RPC_RETURN_FAILURE;
+  }
+
+#if RPC_STATS_SIZE > 0 || RPC_TRACE_SIZE > 0
+  uint32_t duration = RPC_MICROS() - time_start;
+#endif
+#if RPC_STATS_SIZE > 0
+  if (handler_id != 0xff && res != RPC_RETURN_HANDLER_NOT_FOUND && res != RPC_RETURN_FUNCTION_NOT_FOUND) {
+    this->updateStats(handler_id, command_id, res, duration);
   }
+#endif
+
+  this->_context = prev_context;
+
+  if (res == RPC_RETURN_PENDING) {
+    ctx->setPending(true);
+  } else {
+    res = this->finishResult(ctx, res);
+  }
+
+#if RPC_TRACE_SIZE > 0
+  rpc_trace_t *trace = &this->trace[this->trace_index];
+  trace->time = RPC_MILLIS();
+  trace->handler_id = handler_id;
+  trace->command_id = command_id;
+  trace->param_length = length;
+  trace->return_code = res;
+  trace->result_length = ctx->getResultDataLength();
+  trace->duration = duration;
+  this->trace_index = (this->trace_index + 1) % RPC_TRACE_SIZE;
+  if (this->trace_count < RPC_TRACE_SIZE) {
+    this->trace_count++;
+  }
+#endif
 }
 
 /**
- * Read and return the next byte from the result buffer.
- * @return The next byte from result buffer.
+ * Complete a pending request.
+ *
+ * A handler returning RPC_RETURN_PENDING keeps the context of the request and
+ * calls this function as soon as the result has been written to the context,
+ * e.g. from the main loop. The transport sends the result afterwards.
+ * Contexts without a pending request are ignored.
+ *
+ * @param ctx The context passed to the handler
+ * @param code The return code of the command
+ */
+void ArduRPC::complete(ArduRPCContext *ctx, uint8_t code)
+{
+  if (!ctx->isPending() || code == RPC_RETURN_PENDING) {
+    return;
+  }
+  this->finishResult(ctx, code);
+  ctx->setPending(false);
+}
+
+/**
+ * Set the return code and check the result of a processed request.
+ * @param ctx The context of the request
+ * @param code The return code of the command
+ * @return The return code written to the result
+ */
+uint8_t ArduRPC::finishResult(ArduRPCContext *ctx, uint8_t code)
+{
+  // the result has been truncated
+  if (this->countOverflows(ctx)) {
+    ctx->getRawResult()->length = 0;
+    code = RPC_RETURN_FAILURE;
+  }
+
+  ctx->setReturnCode(code);
+  if (ctx->getResultDataLength() == 0 && !ctx->isResultStreamed()) {
+    ctx->writeResult(RPC_NONE);
+  }
+  if (ctx->getResultLength() > this->peak_result_length) {
+    this->peak_result_length = ctx->getResultLength();
+  }
+  return code;
+}
+
+/**
+ * @see ArduRPCContext::readResult()
  */
 uint8_t ArduRPC::readResult()
 {
-  return this->result.data[this->cur_result_read_pos++];
+  return this->getContext()->readResult();
 }
 
 /**
- * Reset the internal processing and result buffer.
+ * Reset the processing and result buffer of the current context.
  * It does *not* remove connected handlers or functions.
  */
 void ArduRPC::reset() {
-  this->result.length = 0;
-  this->data.length = 0;
-  this->cur_data_read_pos = 0;
-  this->cur_result_read_pos = 0;
+  this->getContext()->reset();
 }
 
 /**
@@ -511,146 +858,653 @@ void ArduRPC::reset() {
  * @see connectHandler()
  * @param handler_id The internal handler ID returned while the handler was connected.
  * @param name The name of the handler.
+ * @return true on success | false if the handler ID is invalid
  */
 bool ArduRPC::setHandlerName(uint8_t handler_id, char name[])
 {
   if(handler_id < this->max_handler_count) { 
     strncpy(this->handler_infos[handler_id].name, name, RPC_MAX_NAME_LENGTH);
+    this->generation++;
+    this->updateFingerprint();
+    return true;
   }
+  return false;
 }
 
 /**
- * Set the return code.
- * @param code The return code
+ * @see ArduRPCContext::setReturnCode()
  */
 void ArduRPC::setReturnCode(uint8_t code)
 {
-  this->result.data[0] = code;
+  this->getContext()->setReturnCode(code);
+}
+
+/**
+ * System command getFingerprint (0x05).
+ * @param ctx The context of the request.
+ * @return The return code.
+ */
+uint8_t ArduRPC::systemGetFingerprint(ArduRPCContext *ctx)
+{
+  ctx->writeResult_uint32(this->fingerprint);
+  return RPC_RETURN_SUCCESS;
+}
+
+/**
+ * System command getFunctionList (0x10).
+ * @param ctx The context of the request.
+ * @return The return code.
+ */
+uint8_t ArduRPC::systemGetFunctionList(ArduRPCContext *ctx)
+{
+  ctx->writeResult((char *)this->function_list_cache, this->function_list_length);
+  return RPC_RETURN_SUCCESS;
+}
+
+/**
+ * System command getGeneration (0x04).
+ * @param ctx The context of the request.
+ * @return The return code.
+ */
+uint8_t ArduRPC::systemGetGeneration(ArduRPCContext *ctx)
+{
+  ctx->writeResult_uint16(this->generation);
+  return RPC_RETURN_SUCCESS;
 }
 
 /**
- * Write a byte into the data buffer.
- * @param c The byte to write.
+ * System command getHandlerList (0x20).
+ * @param ctx The context of the request.
+ * @return The return code.
+ */
+uint8_t ArduRPC::systemGetHandlerList(ArduRPCContext *ctx)
+{
+  ctx->writeResult((char *)this->handler_list_cache, this->handler_list_length);
+  return RPC_RETURN_SUCCESS;
+}
+
+/**
+ * System command getHandlerName (0x21).
+ * @param ctx The context of the request.
+ * @return The return code.
+ */
+uint8_t ArduRPC::systemGetHandlerName(ArduRPCContext *ctx)
+{
+  uint8_t handler_id;
+
+  handler_id = ctx->getParam_int8();
+  if (handler_id < this->max_handler_count) {
+    ctx->writeResult(RPC_STRING);
+    ctx->writeResult(RPC_MAX_NAME_LENGTH);
+    ctx->writeResult(this->handler_infos[handler_id].name, RPC_MAX_NAME_LENGTH);
+  }
+  return RPC_RETURN_SUCCESS;
+}
+
+/**
+ * Write an untyped 16bit value as used in the columns of an array.
+ * @param ctx The context to write to.
+ * @param value The value to write.
+ */
+static void rpc_write_column_uint16(ArduRPCContext *ctx, uint16_t value)
+{
+  ctx->writeResult((value >> 8) & 0xff);
+  ctx->writeResult(value & 0xff);
+}
+
+#if RPC_STATS_SIZE > 0 || RPC_TRACE_SIZE > 0
+/**
+ * Write an untyped 32bit value as used in the columns of getStats and getTrace.
+ * @param ctx The context to write to.
+ * @param value The value to write.
+ */
+static void rpc_write_column_uint32(ArduRPCContext *ctx, uint32_t value)
+{
+  ctx->writeResult((value >> 24) & 0xff);
+  ctx->writeResult((value >> 16) & 0xff);
+  ctx->writeResult((value >> 8) & 0xff);
+  ctx->writeResult(value & 0xff);
+}
+#endif
+
+#if RPC_STATS_SIZE > 0
+/**
+ * System command getStats (0x40).
+ * The table is followed by the number of calls not counted because the
+ * table was full.
+ * @param ctx The context of the request.
+ * @return The return code.
+ */
+uint8_t ArduRPC::systemGetStats(ArduRPCContext *ctx)
+{
+  uint8_t i;
+  uint8_t count = 0;
+  rpc_stats_t *stats;
+
+  for (i = 0; i < RPC_STATS_SIZE; i++) {
+    if (this->stats[i].calls > 0) {
+      count++;
+    }
+  }
+
+  ctx->writeResult(RPC_MCARRAY);
+  ctx->writeResult(6);
+  ctx->writeResult(RPC_UINT8);
+  ctx->writeResult(RPC_UINT8);
+  ctx->writeResult(RPC_UINT32);
+  ctx->writeResult(RPC_UINT32);
+  ctx->writeResult(RPC_UINT32);
+  ctx->writeResult(RPC_UINT32);
+  ctx->writeResult(count);
+  for (i = 0; i < RPC_STATS_SIZE; i++) {
+    stats = &this->stats[i];
+    if (stats->calls == 0) {
+      continue;
+    }
+    ctx->writeResult(stats->handler_id);
+    ctx->writeResult(stats->command_id);
+    rpc_write_column_uint32(ctx, stats->calls);
+    rpc_write_column_uint32(ctx, stats->errors);
+    rpc_write_column_uint32(ctx, stats->total_time);
+    rpc_write_column_uint32(ctx, stats->max_time);
+  }
+  ctx->writeResult_uint32(this->stats_dropped);
+  return RPC_RETURN_SUCCESS;
+}
+
+/**
+ * System command resetStats (0x41).
+ * The context of the request is not used and may be NULL.
+ * @return The return code.
+ */
+uint8_t ArduRPC::systemResetStats(ArduRPCContext *)
+{
+  memset(this->stats, 0, sizeof(this->stats));
+  this->stats_dropped = 0;
+  return RPC_RETURN_SUCCESS;
+}
+#endif
+
+#if RPC_TRACE_SIZE > 0
+/**
+ * System command getTrace (0x42).
+ * The records are returned from the oldest to the newest request.
+ * @param ctx The context of the request.
+ * @return The return code.
+ */
+uint8_t ArduRPC::systemGetTrace(ArduRPCContext *ctx)
+{
+  uint8_t i;
+  uint8_t pos;
+  rpc_trace_t *trace;
+
+  ctx->writeResult(RPC_MCARRAY);
+  ctx->writeResult(7);
+  ctx->writeResult(RPC_UINT32);
+  ctx->writeResult(RPC_UINT8);
+  ctx->writeResult(RPC_UINT8);
+  ctx->writeResult(RPC_UINT8);
+  ctx->writeResult(RPC_UINT8);
+  ctx->writeResult(RPC_UINT8);
+  ctx->writeResult(RPC_UINT32);
+  ctx->writeResult(this->trace_count);
+  pos = (this->trace_index + RPC_TRACE_SIZE - this->trace_count) % RPC_TRACE_SIZE;
+  for (i = 0; i < this->trace_count; i++) {
+    trace = &this->trace[pos];
+    rpc_write_column_uint32(ctx, trace->time);
+    ctx->writeResult(trace->handler_id);
+    ctx->writeResult(trace->command_id);
+    ctx->writeResult(trace->param_length);
+    ctx->writeResult(trace->return_code);
+    ctx->writeResult(trace->result_length);
+    rpc_write_column_uint32(ctx, trace->duration);
+    pos = (pos + 1) % RPC_TRACE_SIZE;
+  }
+  return RPC_RETURN_SUCCESS;
+}
+#endif
+
+/**
+ * System command getMemoryInfo (0x43).
+ * @param ctx The context of the request.
+ * @return The return code.
+ */
+uint8_t ArduRPC::systemGetMemoryInfo(ArduRPCContext *ctx)
+{
+  ctx->writeResult(RPC_ARRAY);
+  ctx->writeResult(RPC_UINT16);
+  ctx->writeResult(10);
+  rpc_write_column_uint16(ctx, ctx->getDataSize());
+  rpc_write_column_uint16(ctx, ctx->getResultSize());
+  rpc_write_column_uint16(ctx, this->peak_data_length);
+  rpc_write_column_uint16(ctx, this->peak_result_length);
+  rpc_write_column_uint16(ctx, this->overflow_count);
+  rpc_write_column_uint16(ctx, sizeof(rpc_handler_t) * this->max_handler_count);
+  rpc_write_column_uint16(ctx, sizeof(rpc_handler_info_t) * this->max_handler_count);
+  rpc_write_column_uint16(ctx, sizeof(rpc_function_t) * this->max_function_count);
+  rpc_write_column_uint16(ctx, sizeof(rpc_subscription_t) * this->max_subscription_count);
+  rpc_write_column_uint16(ctx, 10 + 3 * this->max_handler_count + 2 * this->max_function_count);
+  return RPC_RETURN_SUCCESS;
+}
+
+/**
+ * System command subscribe (0x30).
+ * @param ctx The context of the request.
+ * @return The return code.
+ */
+uint8_t ArduRPC::systemSubscribe(ArduRPCContext *ctx)
+{
+  uint8_t params[RPC_MAX_SUBSCRIPTION_PARAM_LENGTH];
+  uint8_t param_length;
+  uint8_t handler_id;
+  uint8_t command_id;
+  uint16_t interval;
+  float threshold;
+  uint8_t i;
+
+  if (ctx->getRequestParamLength() < 8) {
+    return RPC_RETURN_INVALID_REQUEST;
+  }
+  param_length = ctx->getRequestParamLength() - 8;
+  if (param_length > RPC_MAX_SUBSCRIPTION_PARAM_LENGTH) {
+    return RPC_RETURN_INVALID_REQUEST;
+  }
+  handler_id = ctx->getParam_uint8();
+  command_id = ctx->getParam_uint8();
+  interval = ctx->getParam_uint16();
+  threshold = ctx->getParam_float();
+  for (i = 0; i < param_length; i++) {
+    params[i] = ctx->getParam_uint8();
+  }
+  i = this->subscribe(handler_id, command_id, interval, threshold, params, param_length);
+  if (i == 0xff) {
+    return RPC_RETURN_FAILURE;
+  }
+  ctx->writeResult_uint8(i);
+  return RPC_RETURN_SUCCESS;
+}
+
+/**
+ * System command unsubscribe (0x31).
+ * @param ctx The context of the request.
+ * @return The return code.
+ */
+uint8_t ArduRPC::systemUnsubscribe(ArduRPCContext *ctx)
+{
+  if (this->unsubscribe(ctx->getParam_uint8()) == 0xff) {
+    return RPC_RETURN_FAILURE;
+  }
+  return RPC_RETURN_SUCCESS;
+}
+
+/**
+ * Subscribe to a command.
+ * The command is executed periodically by pollSubscriptions().
+ * @see pollSubscriptions()
+ * @param handler_id The ID of the handler
+ * @param command_id The ID of the command
+ * @param interval Minimum time between two executions in milliseconds
+ * @param threshold Minimum change of the value to send a notification
+ * @param params The parameters passed to the command
+ * @param param_length The number of parameter bytes
+ * @return The ID of the subscription or 0xff on error
+ */
+uint8_t ArduRPC::subscribe(uint8_t handler_id, uint8_t command_id, uint16_t interval, float threshold, uint8_t *params, uint8_t param_length)
+{
+  uint8_t i;
+  rpc_subscription_t *subscription;
+
+  if (param_length > RPC_MAX_SUBSCRIPTION_PARAM_LENGTH) {
+    return 0xff;
+  }
+
+  for (i = 0; i < this->max_subscription_count; i++) {
+    subscription = &this->subscriptions[i];
+    if (subscription->state != RPC_SUBSCRIPTION_STATE_FREE) {
+      continue;
+    }
+    subscription->state = RPC_SUBSCRIPTION_STATE_ACTIVE;
+    subscription->handler_id = handler_id;
+    subscription->command_id = command_id;
+    subscription->interval = interval;
+    subscription->threshold = threshold;
+    subscription->param_length = param_length;
+    memcpy(subscription->params, params, param_length);
+    return i;
+  }
+  return 0xff;
+}
+
+/**
+ * Remove a subscription.
+ * @param subscription_id The ID returned by subscribe()
+ * @return The ID of the subscription or 0xff on error
+ */
+uint8_t ArduRPC::unsubscribe(uint8_t subscription_id)
+{
+  if (subscription_id >= this->max_subscription_count) {
+    return 0xff;
+  }
+  if (this->subscriptions[subscription_id].state == RPC_SUBSCRIPTION_STATE_FREE) {
+    return 0xff;
+  }
+  this->subscriptions[subscription_id].state = RPC_SUBSCRIPTION_STATE_FREE;
+  return subscription_id;
+}
+
+/**
+ * Remove all subscriptions of a handler or function.
+ * @param handler_id The ID of the handler. 0xfe for functions
+ * @param command_id The ID of the command or function. -1 for all commands
+ */
+void ArduRPC::removeSubscriptions(uint8_t handler_id, int16_t command_id)
+{
+  uint8_t i;
+  rpc_subscription_t *subscription;
+
+  for (i = 0; i < this->max_subscription_count; i++) {
+    subscription = &this->subscriptions[i];
+    if (subscription->handler_id == handler_id &&
+        (command_id < 0 || subscription->command_id == command_id)) {
+      subscription->state = RPC_SUBSCRIPTION_STATE_FREE;
+    }
+  }
+}
+
+#if RPC_STATS_SIZE > 0
+/**
+ * Remove the statistics of a handler or function.
+ * The remaining entries are moved to the front of the table.
+ * @param handler_id The ID of the handler. 0xfe for functions
+ * @param command_id The ID of the command or function. -1 for all commands
+ */
+void ArduRPC::removeStats(uint8_t handler_id, int16_t command_id)
+{
+  uint8_t i;
+  uint8_t j = 0;
+  rpc_stats_t *stats;
+
+  for (i = 0; i < RPC_STATS_SIZE && this->stats[i].calls > 0; i++) {
+    stats = &this->stats[i];
+    if (stats->handler_id == handler_id &&
+        (command_id < 0 || stats->command_id == command_id)) {
+      continue;
+    }
+    if (i != j) {
+      this->stats[j] = *stats;
+    }
+    j++;
+  }
+  for (; j < i; j++) {
+    memset(&this->stats[j], 0, sizeof(rpc_stats_t));
+  }
+}
+#endif
+
+/**
+ * Add the rejected writes of a context to the overflow counter.
+ * @param ctx The context
+ * @return true if writes have been rejected since the last call
+ */
+bool ArduRPC::countOverflows(ArduRPCContext *ctx)
+{
+  uint8_t count = ctx->takeOverflowCount();
+
+  if (count == 0) {
+    return false;
+  }
+  if (this->overflow_count > 0xffff - count) {
+    this->overflow_count = 0xffff;
+  } else {
+    this->overflow_count += count;
+  }
+  return true;
+}
+
+#if RPC_STATS_SIZE > 0
+/**
+ * Count a call in the statistics table.
+ * @param handler_id The ID of the handler. 0xfe for functions
+ * @param command_id The ID of the command or function
+ * @param code The return code
+ * @param time The time spent in the call in microseconds
+ */
+void ArduRPC::updateStats(uint8_t handler_id, uint8_t command_id, uint8_t code, uint32_t time)
+{
+  uint8_t i;
+  rpc_stats_t *stats;
+
+  for (i = 0; i < RPC_STATS_SIZE; i++) {
+    stats = &this->stats[i];
+    if (stats->calls == 0) {
+      stats->handler_id = handler_id;
+      stats->command_id = command_id;
+      break;
+    }
+    if (stats->handler_id == handler_id && stats->command_id == command_id) {
+      break;
+    }
+  }
+  if (i >= RPC_STATS_SIZE) {
+    this->stats_dropped++;
+    return;
+  }
+
+  stats->calls++;
+  if (code != RPC_RETURN_SUCCESS && code != RPC_RETURN_PENDING) {
+    stats->errors++;
+  }
+  stats->total_time += time;
+  if (time > stats->max_time) {
+    stats->max_time = time;
+  }
+}
+#endif
+
+/**
+ * Serialize the responses of the system commands depending on the connected
+ * handlers and functions and increment the generation.
+ *
+ * Must be called every time a handler or function is connected or
+ * disconnected.
+ */
+void ArduRPC::updateSystemCache()
+{
+  uint8_t i;
+  uint8_t *data;
+  uint16_t handler_type;
+
+  data = this->function_list_cache;
+  data[0] = RPC_MCARRAY;
+  data[1] = 2;
+  data[2] = RPC_UINT8;
+  data[3] = RPC_UINT8;
+  data[4] = 0;
+  data += 5;
+  for (i = 0; i < this->function_index; i++) {
+    if (this->functions[i].callback == NULL) {
+      continue;
+    }
+    *data++ = i;
+    *data++ = this->functions[i].type;
+    this->function_list_cache[4]++;
+  }
+  this->function_list_length = data - this->function_list_cache;
+
+  data = this->handler_list_cache;
+  data[0] = RPC_MCARRAY;
+  data[1] = 2;
+  data[2] = RPC_UINT8;
+  data[3] = RPC_UINT16;
+  data[4] = 0;
+  data += 5;
+  for (i = 0; i < this->max_handler_count; i++) {
+    if (this->handlers[i].handler == NULL) {
+      continue;
+    }
+    this->handler_list_cache[4]++;
+    handler_type = this->handlers[i].type;
+    *data++ = i;
+    *data++ = (handler_type >> 8) & 0xff;
+    *data++ = handler_type & 0xff;
+  }
+  this->handler_list_length = data - this->handler_list_cache;
+  this->generation++;
+  this->updateFingerprint();
+}
+
+/**
+ * Hash data with FNV-1a.
+ * @param hash The hash of the previous data
+ * @param data The data to add
+ * @param length Number of bytes
+ * @return The new hash
+ */
+static uint32_t rpc_fnv1a(uint32_t hash, const uint8_t *data, uint16_t length)
+{
+  uint16_t i;
+
+  for (i = 0; i < length; i++) {
+    hash ^= data[i];
+    hash *= 16777619UL;
+  }
+  return hash;
+}
+
+/**
+ * Compute the fingerprint from the library version and the precomputed
+ * handler and function lists.
+ *
+ * @see getFingerprint()
+ */
+void ArduRPC::updateFingerprint()
+{
+  static const uint8_t version[] = {RPC_VERSION_MAJOR, RPC_VERSION_MINOR, RPC_VERSION_PATCH};
+  uint32_t hash = 2166136261UL;
+  uint8_t i;
+  uint8_t length;
+
+  hash = rpc_fnv1a(hash, version, sizeof(version));
+  hash = rpc_fnv1a(hash, this->handler_list_cache, this->handler_list_length);
+  for (i = 0; i < this->max_handler_count; i++) {
+    if (this->handlers[i].handler == NULL) {
+      continue;
+    }
+    for (length = 0; length < RPC_MAX_NAME_LENGTH && this->handler_infos[i].name[length] != '\0'; length++) {
+    }
+    hash = rpc_fnv1a(hash, &length, 1);
+    hash = rpc_fnv1a(hash, (uint8_t *)this->handler_infos[i].name, length);
+  }
+  hash = rpc_fnv1a(hash, this->function_list_cache, this->function_list_length);
+  if (hash == 0) {
+    // 0 marks an empty cache on the client
+    hash = 1;
+  }
+  this->fingerprint = hash;
+}
+
+/**
+ * @see ArduRPCContext::writeData()
  */
 bool ArduRPC::writeData(uint8_t c)
 {
-  this->data.data[this->data.length] = c;
-  this->data.length++;
+  return this->getContext()->writeData(c);
 }
 
 /**
- * Write a byte into the result buffer.
- * @param c The byte to write.
+ * @see ArduRPCContext::writeResult()
  */
 bool ArduRPC::writeResult(uint8_t c)
 {
-  this->result.length++;
-  this->result.data[this->result.length] = c;
+  return this->getContext()->writeResult(c);
 }
 
 /**
- * Write a string into the result buffer.
- * @param string A pointer to the string.
- * @param length The length of the string to copy.
+ * @see ArduRPCContext::writeResult()
  */
-bool ArduRPC::writeResult(char *string, uint8_t length)
+bool ArduRPC::writeResult(char *string, uint16_t length)
 {
-  memcpy(&this->result.data[this->result.length + 1], string, length);
-  this->result.length = this->result.length + length;
+  return this->getContext()->writeResult(string, length);
 }
 
 /**
- * Write a value of type FLOAT
- * @param value The value to write.
+ * @see ArduRPCContext::writeResult_float()
  */
 bool ArduRPC::writeResult_float(float value)
 {
-  uint8_t *v = (uint8_t *)&value;
-  this->writeResult(RPC_FLOAT);
-  this->writeResult(v[3]);
-  this->writeResult(v[2]);
-  this->writeResult(v[1]);
-  this->writeResult(v[0]);
+  return this->getContext()->writeResult_float(value);
 }
 
 /**
- * Write a value of type INT8
- * @param value The value to write.
+ * @see ArduRPCContext::writeResult_int8()
  */
 bool ArduRPC::writeResult_int8(int8_t value)
 {
-  this->writeResult(RPC_INT8);
-  this->writeResult(value);
+  return this->getContext()->writeResult_int8(value);
 }
 
 /**
- * Write a value of type INT16
- * @param value The value to write.
+ * @see ArduRPCContext::writeResult_int16()
  */
 bool ArduRPC::writeResult_int16(int16_t value)
 {
-  this->writeResult(RPC_INT16);
-  this->writeResult((((value) >> 8) & 0xff));
-  this->writeResult(((value) & 0xff));
+  return this->getContext()->writeResult_int16(value);
 }
 
 /**
- * Write a value of type INT32
- * @param value The value to write.
+ * @see ArduRPCContext::writeResult_int32()
  */
 bool ArduRPC::writeResult_int32(int32_t value)
 {
-  this->writeResult(RPC_INT32);
-  this->writeResult((((value) >> 24) & 0xff));
-  this->writeResult((((value) >> 16) & 0xff));
-  this->writeResult((((value) >> 8) & 0xff));
-  this->writeResult(((value) & 0xff));
+  return this->getContext()->writeResult_int32(value);
 }
 
 /**
- * Write a value of type STRING
- * @param value The value to write.
- * @param length The string length.
+ * @see ArduRPCContext::writeResult_string()
  */
 bool ArduRPC::writeResult_string(char *value, uint8_t length)
 {
-  this->writeResult(RPC_STRING);
-  this->writeResult(length);
-  this->writeResult(value, length);
+  return this->getContext()->writeResult_string(value, length);
 }
 
 /**
- * Write a value of type UINT8
- * @param value The value to write.
+ * @see ArduRPCContext::writeResult_uint8()
  */
 bool ArduRPC::writeResult_uint8(uint8_t value)
 {
-  this->writeResult(RPC_UINT8);
-  this->writeResult(value);
+  return this->getContext()->writeResult_uint8(value);
 }
 
 /**
- * Write a value of type UINT16
- * @param value The value to write.
+ * @see ArduRPCContext::writeResult_uint16()
  */
 bool ArduRPC::writeResult_uint16(uint16_t value)
 {
-  this->writeResult(RPC_UINT16);
-  this->writeResult((((value) >> 8) & 0xff));
-  this->writeResult(((value) & 0xff));
+  return this->getContext()->writeResult_uint16(value);
 }
 
 /**
- * Write a value of type UINT32
- * @param value The value to write.
+ * @see ArduRPCContext::writeResult_uint32()
  */
 bool ArduRPC::writeResult_uint32(uint32_t value)
 {
-  this->writeResult(RPC_UINT32);
-  this->writeResult((((value) >> 24) & 0xff));
-  this->writeResult((((value) >> 16) & 0xff));
-  this->writeResult((((value) >> 8) & 0xff));
-  this->writeResult(((value) & 0xff));
+  return this->getContext()->writeResult_uint32(value);
+}
+
+/**
+ * @see ArduRPCContext::writeResult_varint()
+ */
+bool ArduRPC::writeResult_varint(int32_t value)
+{
+  return this->getContext()->writeResult_varint(value);
+}
+
+/**
+ * @see ArduRPCContext::writeResult_varuint()
+ */
+bool ArduRPC::writeResult_varuint(uint32_t value)
+{
+  return this->getContext()->writeResult_varuint(value);
 }
 
 /**
@@ -662,6 +1516,35 @@ ArduRPCHandler::ArduRPCHandler()
   this->type = 0;
 }
 
+/**
+ * Call a command of the handler.
+ *
+ * Handlers written before ArduRPCContext was available override this function
+ * and use the getParam_*() and writeResult_*() functions of ArduRPC. The
+ * default implementation ignores the ID of the command.
+ *
+ * @return The return code
+ */
+uint8_t ArduRPCHandler::call(uint8_t)
+{
+  return RPC_RETURN_COMMAND_NOT_FOUND;
+}
+
+/**
+ * Call a command of the handler with the context of the request.
+ *
+ * Override this function to read the parameters from and write the result to
+ * the given context. The default implementation ignores the context and calls
+ * call(uint8_t), which uses the current context of ArduRPC.
+ *
+ * @param cmd_id: The ID of the command
+ * @return The return code
+ */
+uint8_t ArduRPCHandler::call(ArduRPCContext *, uint8_t cmd_id)
+{
+  return this->call(cmd_id);
+}
+
 /**
  * Internal function to register the handler.
  *
@@ -670,6 +1553,7 @@ ArduRPCHandler::ArduRPCHandler()
  * @param rpc: The AarduRPC object
  * @param name: The name of the handler
  * @param handler: Pointer to the handler.
+ * @return The ID of the handler or 0xff on error
  */
 uint8_t ArduRPCHandler::registerSelf(ArduRPC &rpc, char *name, void *handler)
 {
@@ -682,6 +1566,7 @@ uint8_t ArduRPCHandler::registerSelf(ArduRPC &rpc, char *name, void *handler)
 
   handler_id = r->connectHandler(handler);
   r->setHandlerName(handler_id, name);
+  return handler_id;
 }
 
 /**
@@ -691,6 +1576,7 @@ uint8_t ArduRPCHandler::registerSelf(ArduRPC &rpc, char *name, void *handler)
  *
  * @param rpc: The AarduRPC object
  * @param name: The name of the handler
+ * @return The ID of the handler or 0xff on error
  */
 uint8_t ArduRPCHandler::registerSelf(ArduRPC &rpc, char *name)
 {
@@ -703,6 +1589,7 @@ uint8_t ArduRPCHandler::registerSelf(ArduRPC &rpc, char *name)
 
   handler_id = r->connectHandler((void *)this);
   r->setHandlerName(handler_id, name);
+  return handler_id;
 }
 
 /**
@@ -712,7 +1599,8 @@ uint8_t ArduRPCHandler::registerSelf(ArduRPC &rpc, char *name)
  *
  * @param rpc: The AarduRPC object
  * @param name: The name of the handler
- * @param handler_id:
+ * @param handler_id: The ID of the handler
+ * @return The ID of the handler or 0xff on error
  */
 uint8_t ArduRPCHandler::registerSelf(ArduRPC &rpc, char *name, uint8_t handler_id)
 {
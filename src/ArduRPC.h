@@ -44,11 +44,66 @@
 /*! Keep it as small as possible and don't waste memory */
 #define RPC_MAX_NAME_LENGTH 16
 
+//! Maximum number of parameter bytes stored for each subscription
+#define RPC_MAX_SUBSCRIPTION_PARAM_LENGTH 4
+
+//! Maximum number of bytes of a notification received by ArduRPCRequest_Serial
+#define RPC_MAX_NOTIFICATION_LENGTH 32
+
+//! Set to 0 to build without ArduRPC_Network and Client.h, e.g. on a host
+#define RPC_NETWORK 1
+
+//! Number of contexts shared by all connections of ArduRPC_Network
+/*! Each context allocates its own data and result buffer */
+#define RPC_NETWORK_CONTEXT_COUNT 1
+
+//! Number of bytes ArduRPC_Network reads from a connection at once
+#define RPC_NETWORK_CHUNK_SIZE 32
+
+//! Number of bytes ArduRPC_Socket reads from a connection at once
+#define RPC_SOCKET_CHUNK_SIZE 4096
+
+//! Maximum number of events ArduRPC_Socket handles with one epoll_wait()
+#define RPC_SOCKET_MAX_EVENTS 64
+
+//! Number of unsent bytes after which ArduRPC_Socket stops reading from a connection
+#define RPC_SOCKET_MAX_OUTPUT 65536
+
+//! Size of the buffer for priority requests ('*') of ArduRPC_Serial
+/*! Used for the request and the result. Set to 0 to disable priority requests */
+#define RPC_SERIAL_PRIORITY_LENGTH 32
+
+//! Number of handlers and functions stored by ArduRPCRequest::discover()
+#define RPC_DISCOVERY_HANDLER_COUNT 8
+#define RPC_DISCOVERY_FUNCTION_COUNT 8
+
+//! Bytes sent with every request of ArduRPCRequestFramebuffer besides the pixels
+/*! Rows are merged into one rectangle while the unchanged pixels cost fewer bytes */
+#define RPC_FRAMEBUFFER_REQUEST_COST 16
+
+//! Number of (handler, command) pairs to collect call statistics for
+/*! Set to 0 to disable the statistics */
+#define RPC_STATS_SIZE 0
+
+//! Number of requests to keep in the trace ring buffer
+/*! Set to 0 to disable tracing */
+#define RPC_TRACE_SIZE 0
+
+//! Uncomment to replace millis() and micros() with a clock advanced by rpc_clock_advance()
+//#define RPC_VIRTUAL_CLOCK
+
+//! Time in microseconds the virtual clock advances while waiting in RPC_DELAY()
+#define RPC_VIRTUAL_CLOCK_STEP 1000
+
 // Uncomment to get debug information over serial
 //#define RPC_DEBUG
 
 /* Config end */
 
+#if RPC_NETWORK > 0
+#include <Client.h>
+#endif
+
 //! Major version
 #define RPC_VERSION_MAJOR 0
 
@@ -85,6 +140,10 @@
 //! Datatype identifier
 #define RPC_FLOAT 0x09
 //! Datatype identifier
+#define RPC_VARUINT 0x0A // LEB128
+//! Datatype identifier
+#define RPC_VARINT 0x0B // zigzag + LEB128
+//! Datatype identifier
 #define RPC_ARRAY 0x10
 //! Datatype identifier
 #define RPC_STRING 0x11
@@ -93,6 +152,24 @@
 //! Datatype identifier
 #define RPC_VARRAY 0x13  // 
 
+//! No request has been sent
+#define RPC_REQUEST_STATE_IDLE 0
+//! The request has been sent and the result is not available yet
+#define RPC_REQUEST_STATE_PENDING 1
+//! The result has been received
+#define RPC_REQUEST_STATE_DONE 2
+//! An error occurred e.g. the request has timed out
+#define RPC_REQUEST_STATE_ERROR 3
+
+//! Encoded pixels: Color values of every pixel
+#define RPC_PIXEL_ENCODING_RAW 0x00
+//! Encoded pixels: Runs of pixels with the same color
+#define RPC_PIXEL_ENCODING_RLE 0x01
+//! Encoded pixels: Unchanged pixels are skipped followed by a run of pixels with the same color
+#define RPC_PIXEL_ENCODING_DELTA 0x02
+//! Pixel strip: Show the pixels after they have been set
+#define RPC_PIXEL_STRIP_SHOW 0x01
+
 //! The command has been executed successfully
 #define RPC_RETURN_SUCCESS 0
 //! Error in the packet data
@@ -107,6 +184,9 @@
 #define RPC_RETURN_COMMAND_NOT_FOUND 126
 //! An error occurred 
 #define RPC_RETURN_FAILURE 127
+//! The handler completes the request later by calling ArduRPC::complete()
+/*! Only used internally, it is never sent to the client */
+#define RPC_RETURN_PENDING 0xff
 
 #ifdef RPC_DEBUG
 #define RPC_DEBUG_CMD(...) (__VA_ARGS__)
@@ -118,6 +198,15 @@
 #define RPC_DEBUG_PRINTLN(...)
 #endif /* defined RPC_DEBUG */
 
+#ifdef RPC_VIRTUAL_CLOCK
+#define RPC_MICROS() rpc_clock_micros()
+#define RPC_MILLIS() rpc_clock_millis()
+#else /* defined RPC_VIRTUAL_CLOCK */
+#define RPC_MICROS() micros()
+#define RPC_MILLIS() millis()
+#endif /* defined RPC_VIRTUAL_CLOCK */
+#define RPC_DELAY(ms) rpc_delay(ms)
+
 
 //! Type is used for the processing buffer
 typedef struct {
@@ -143,8 +232,13 @@ typedef struct {
   void *callback;
   //! A pointer to the arguments passed to the callback.
   void *arguments;
+  //! Additional flags. See RPC_FUNCTION_FLAG_*
+  uint8_t flags;
 } rpc_function_t;
 
+//! The callback of the function takes an ArduRPCContext instead of ArduRPC
+#define RPC_FUNCTION_FLAG_CONTEXT 0x01
+
 //! Used to store main information about a rpc handler.
 typedef struct {
   //! The type of the rpc handler. See documentation for more information.
@@ -153,6 +247,41 @@ typedef struct {
   void *handler;
 } rpc_handler_t;
 
+//! A command executed periodically to notify the client about changed values
+typedef struct {
+  //! The state of the subscription. See RPC_SUBSCRIPTION_STATE_*
+  uint8_t state;
+  //! The ID of the handler
+  uint8_t handler_id;
+  //! The ID of the command
+  uint8_t command_id;
+  //! The number of parameter bytes
+  uint8_t param_length;
+  //! The parameters passed to the command
+  uint8_t params[RPC_MAX_SUBSCRIPTION_PARAM_LENGTH];
+  //! Minimum time between two executions in milliseconds
+  uint16_t interval;
+  //! Minimum change of the value to send a notification. 0 = send every time
+  float threshold;
+  //! The value sent with the last notification
+  float last_value;
+  //! Time of the last execution
+  unsigned long last_time;
+} rpc_subscription_t;
+
+//! The subscription slot is not used
+#define RPC_SUBSCRIPTION_STATE_FREE 0
+//! The subscription is active but no notification has been sent
+#define RPC_SUBSCRIPTION_STATE_ACTIVE 1
+//! The subscription is active and last_value is valid
+#define RPC_SUBSCRIPTION_STATE_NOTIFIED 2
+
+//! Callback function to receive notifications
+typedef void (*rpc_notification_callback_t)(uint8_t subscription_id, uint8_t *data, uint8_t length, void *arg);
+
+//! Callback function to receive the data of a result sent in parts
+typedef void (*rpc_result_part_callback_t)(uint8_t *data, uint8_t length, void *arg);
+
 //! Additional information about a rpc handler. But not used for rpc functions.
 typedef struct {
   //! The name of the handler
@@ -163,6 +292,241 @@ typedef struct {
   uint16_t eeprom_address;
 } rpc_handler_info_t;
 
+//! A handler read by ArduRPCRequest::discover()
+typedef struct {
+  //! The ID of the handler
+  uint8_t id;
+  //! The type of the handler
+  uint16_t type;
+  //! The name of the handler, always terminated with '\0'
+  char name[RPC_MAX_NAME_LENGTH + 1];
+} rpc_discovered_handler_t;
+
+//! A function read by ArduRPCRequest::discover()
+typedef struct {
+  //! The ID of the function
+  uint8_t id;
+  //! The type of the function
+  uint8_t type;
+} rpc_discovered_function_t;
+
+//! Handlers and functions of a device. Can be stored, e.g. in the EEPROM, and reused after a restart
+typedef struct {
+  //! The fingerprint of the device. 0 if the cache is empty
+  uint32_t fingerprint;
+  //! Number of handlers
+  uint8_t handler_count;
+  //! Number of functions
+  uint8_t function_count;
+  //! The handlers
+  rpc_discovered_handler_t handlers[RPC_DISCOVERY_HANDLER_COUNT];
+  //! The functions
+  rpc_discovered_function_t functions[RPC_DISCOVERY_FUNCTION_COUNT];
+} rpc_discovery_cache_t;
+
+class ArduRPC;
+class ArduRPCContext;
+
+//! Callback function called while waiting in RPC_DELAY()
+typedef void (*rpc_idle_callback_t)(void *arg);
+
+#ifdef RPC_VIRTUAL_CLOCK
+uint32_t
+  rpc_clock_micros(),
+  rpc_clock_millis();
+void
+  rpc_clock_advance(uint32_t us);
+#endif
+void
+  rpc_delay(uint32_t ms),
+  rpc_set_idle_callback(rpc_idle_callback_t callback, void *arg);
+
+//! Callback function for a rpc function
+typedef uint8_t (*rpc_callback_function_t)(ArduRPC *rpc, void *);
+//! Callback function for a rpc function with its own request context
+typedef uint8_t (*rpc_context_callback_function_t)(ArduRPCContext *ctx, void *);
+//! Callback function for a rpc handler
+typedef uint8_t (*rpc_callback_handler_t)(uint8_t, ArduRPC *rpc, void *);
+
+//! Call statistics of a command
+typedef struct {
+  //! The ID of the handler. 0xfe for functions
+  uint8_t handler_id;
+  //! The ID of the command or function
+  uint8_t command_id;
+  //! Number of calls
+  uint32_t calls;
+  //! Number of calls with a return code other than RPC_RETURN_SUCCESS
+  uint32_t errors;
+  //! Time spent in the command in microseconds
+  uint32_t total_time;
+  //! Longest call in microseconds
+  uint32_t max_time;
+} rpc_stats_t;
+
+//! Trace record of a processed request
+typedef struct {
+  //! Time the request has been processed in milliseconds
+  uint32_t time;
+  //! The ID of the handler
+  uint8_t handler_id;
+  //! The ID of the command
+  uint8_t command_id;
+  //! Length of the parameters
+  uint8_t param_length;
+  //! The return code
+  uint8_t return_code;
+  //! Length of the result
+  uint8_t result_length;
+  //! Time spent in the handler in microseconds
+  uint32_t duration;
+} rpc_trace_t;
+
+//! Entry in the table of system commands
+typedef struct {
+  //! The ID of the command
+  uint8_t cmd_id;
+  //! Precomputed response stored in flash or NULL
+  const uint8_t *response;
+  //! Length of the precomputed response
+  uint8_t response_length;
+  //! Function to call if no precomputed response is available
+  uint8_t (ArduRPC::*call)(ArduRPCContext *ctx);
+} rpc_system_call_t;
+
+/**
+ * Interface of transports sending results in chunks.
+ *
+ * If a writer is set and the result buffer of a context is full, the buffered
+ * result data is passed to the writer and the buffer is reused.
+ */
+class ArduRPCResultWriter
+{
+  public:
+    /**
+     * Send a part of the result.
+     *
+     * @param ctx The context of the request
+     * @param data The result data without return code
+     * @param length Number of bytes
+     */
+    virtual void writeResultChunk(ArduRPCContext *ctx, uint8_t *data, uint8_t length) = 0;
+};
+
+/**
+ * Hold all state of a single request.
+ *
+ * This includes the data and the result buffer and the current read positions.
+ * Every call to ArduRPC::process() works on its own context. Use additional
+ * contexts with their own buffers to process requests concurrently, e.g. from
+ * an interrupt or from within a handler.
+ */
+class ArduRPCContext
+{
+  public:
+    ArduRPCContext();
+    ArduRPCContext(uint8_t *data, uint8_t *result);
+    ArduRPCContext(uint8_t *data, uint8_t *result, uint16_t data_size, uint16_t result_size);
+    bool
+      writeData(uint8_t c),
+      writeResult(uint8_t c),
+      writeResult(char *string, uint16_t length),
+      writeResult_P(const uint8_t *data, uint8_t length),
+      writeResult_float(float value),
+      writeResult_int8(int8_t value),
+      writeResult_int16(int16_t value),
+      writeResult_int32(int32_t value),
+      writeResult_string(char *string, uint8_t length),
+      writeResult_uint8(uint8_t value),
+      writeResult_uint16(uint16_t value),
+      writeResult_uint32(uint32_t value),
+      writeResult_varint(int32_t value),
+      writeResult_varuint(uint32_t value);
+    uint8_t
+      readResult(),
+      *getResultData(),
+      copyData(uint8_t *src, uint8_t len),
+      getRequestParamLength(),
+      getResultLength(),
+      getResultDataLength(),
+      takeOverflowCount();
+    bool
+      isPending(),
+      isPendingAllowed(),
+      isResultStreamed();
+    void
+      reset(),
+      setPending(bool pending),
+      setPendingAllowed(bool allowed),
+      setResultWriter(ArduRPCResultWriter *writer),
+      setReturnCode(uint8_t code);
+    // get params
+    char
+      getParam_char();
+    float
+      getParam_float();
+    int8_t
+      getParam_int8();
+    int16_t
+      getParam_int16();
+    int32_t
+      getParam_int32();
+    uint8_t
+      getParam_encodedPixels(uint8_t *framebuffer, uint16_t pixel_count, uint8_t color_count),
+      getParam_pixels(uint8_t *framebuffer, uint16_t pixel_count, uint8_t color_count),
+      getParam_uint8(),
+      getParam_string(char *dst, uint8_t max_length);
+    uint16_t
+      getDataSize(),
+      getParam_uint16(),
+      getResultSize();
+    uint32_t
+      getParam_uint32(),
+      getParam_varuint();
+    int32_t
+      getParam_varint();
+    rpc_data_t
+      *getRawData();
+    rpc_result_t
+      *getRawResult();
+  private:
+    bool
+      writeResult_raw_varuint(uint8_t type, uint32_t value),
+      flushResult(),
+      reserveData(uint8_t length),
+      reserveResult(uint16_t length);
+    uint8_t
+      getResultSpace();
+
+    rpc_result_t
+      //! Result buffer
+      result;
+    rpc_data_t
+      //! Data buffer
+      data;
+
+    uint8_t
+      //! Current position in the data buffer while reading data
+      cur_data_read_pos,
+      //! Current position in the result buffer while reading data
+      cur_result_read_pos,
+      //! Number of writes rejected because a buffer was full
+      overflow_count;
+    //! Transport to send result chunks to or NULL
+    ArduRPCResultWriter *result_writer;
+    //! true if parts of the result have been passed to the writer
+    bool result_streamed;
+    //! true if the handler has not completed the request yet
+    bool pending;
+    //! true if the transport waits for pending requests to be completed
+    bool pending_allowed;
+    uint16_t
+      //! Size of the data buffer
+      data_size,
+      //! Size of the result buffer
+      result_size;
+};
+
 /**
  * The main class to handle rpc on a microcontroller.
  *
@@ -175,17 +539,21 @@ typedef struct {
  *   - query the system and get additional information
  *     - available handlers and functions
  *     - name of a handler
+ *
+ * The request and result data is stored in an ArduRPCContext. The methods to
+ * read parameters and write results are kept for compatibility and operate on
+ * the context of the request currently processed.
  */
 
 class ArduRPC
 {
   public:
-    ArduRPC(uint8_t handler_count=8, uint8_t function_count=8);
+    ArduRPC(uint8_t handler_count=8, uint8_t function_count=8, uint8_t subscription_count=0);
     bool
       setHandlerName(uint8_t handler_id, char name[]),
       writeData(uint8_t c),
       writeResult(uint8_t c),
-      writeResult(char *string, uint8_t length),
+      writeResult(char *string, uint16_t length),
       writeResult_float(float value),
       writeResult_int8(int8_t value),
       writeResult_int16(int16_t value),
@@ -193,22 +561,33 @@ class ArduRPC
       writeResult_string(char *string, uint8_t length),
       writeResult_uint8(uint8_t value),
       writeResult_uint16(uint16_t value),
-      writeResult_uint32(uint32_t value);
+      writeResult_uint32(uint32_t value),
+      writeResult_varint(int32_t value),
+      writeResult_varuint(uint32_t value);
     uint8_t
       connectFunction(rpc_function_t function),
       connectFunction(uint8_t type, void *callback, void *arguments),
+      connectFunction(uint8_t type, rpc_context_callback_function_t callback, void *arguments),
       connectHandler(rpc_handler_t handler),
       connectHandler(rpc_handler_t, uint8_t),
       connectHandler(void *handler),
       connectHandler(void *, uint8_t),
+      disconnectFunction(uint8_t function_id),
+      disconnectHandler(uint8_t handler_id),
+      replaceHandler(void *handler, uint8_t handler_id),
       readResult(),
       *getResultData(),
       copyData(uint8_t *src, uint8_t len),
       getRequestParamLength(),
       getResultLength(),
-      getResultDataLength();
+      getResultDataLength(),
+      pollSubscriptions(ArduRPCContext *ctx),
+      subscribe(uint8_t handler_id, uint8_t command_id, uint16_t interval, float threshold, uint8_t *params, uint8_t param_length),
+      unsubscribe(uint8_t subscription_id);
     void
+      complete(ArduRPCContext *ctx, uint8_t code),
       process(),
+      process(ArduRPCContext *ctx),
       reset(),
       setReturnCode(uint8_t code);
     // get params
@@ -226,19 +605,57 @@ class ArduRPC
       getParam_uint8(),
       getParam_string(char *dst, uint8_t max_length);
     uint16_t
+      getGeneration(),
       getParam_uint16();
     uint32_t
-      getParam_uint32();
+      getFingerprint(),
+      getParam_uint32(),
+      getParam_varuint();
+    int32_t
+      getParam_varint();
     rpc_data_t
       *getRawData();
     rpc_result_t
       *getRawResult();
+    ArduRPCContext
+      *getContext();
   private:
     /* functions */
     uint8_t
-      handleSystemCalls(uint8_t cmd_id);
+      handleSystemCalls(ArduRPCContext *ctx, uint8_t cmd_id),
+      systemGetFingerprint(ArduRPCContext *ctx),
+      systemGetFunctionList(ArduRPCContext *ctx),
+      systemGetGeneration(ArduRPCContext *ctx),
+      systemGetHandlerList(ArduRPCContext *ctx),
+      systemGetHandlerName(ArduRPCContext *ctx),
+      systemGetMemoryInfo(ArduRPCContext *ctx),
+      systemSubscribe(ArduRPCContext *ctx),
+      systemUnsubscribe(ArduRPCContext *ctx);
+    bool
+      countOverflows(ArduRPCContext *ctx);
+    uint8_t
+      finishResult(ArduRPCContext *ctx, uint8_t code);
+    void
+      removeSubscriptions(uint8_t handler_id, int16_t command_id),
+      updateFingerprint(),
+      updateSystemCache();
+#if RPC_STATS_SIZE > 0
+    uint8_t
+      systemGetStats(ArduRPCContext *ctx),
+      systemResetStats(ArduRPCContext *ctx);
+    void
+      removeStats(uint8_t handler_id, int16_t command_id),
+      updateStats(uint8_t handler_id, uint8_t command_id, uint8_t code, uint32_t time);
+#endif
+#if RPC_TRACE_SIZE > 0
+    uint8_t
+      systemGetTrace(ArduRPCContext *ctx);
+#endif
 
     /* vars */
+    static const rpc_system_call_t
+      //! Table of system commands
+      system_calls[];
     rpc_handler_t
       //! List of connected rpc handlers
       *handlers;
@@ -246,31 +663,76 @@ class ArduRPC
       //! List of connected rpc functions
       *functions;
 
-    rpc_result_t
-      //! Result buffer
-      result;
-    rpc_data_t
-      //! Data buffer
-      data;
-
     rpc_handler_info_t
       //! Additional information for connected handlers
       *handler_infos;
 
+    rpc_subscription_t
+      //! List of subscriptions
+      *subscriptions;
+
+    uint8_t
+      //! Longest request processed
+      peak_data_length,
+      //! Longest result returned
+      peak_result_length;
+    uint16_t
+      //! Number of writes rejected because a buffer was full
+      overflow_count,
+      //! Incremented every time a handler or function is changed
+      generation;
+    uint32_t
+      //! Hash of the library version, the handlers and the functions
+      fingerprint;
+    uint8_t
+      //! Precomputed response of getFunctionList
+      *function_list_cache,
+      //! Precomputed response of getHandlerList
+      *handler_list_cache;
+    uint16_t
+      //! Length of the precomputed response of getFunctionList
+      function_list_length,
+      //! Length of the precomputed response of getHandlerList
+      handler_list_length;
+
+#if RPC_STATS_SIZE > 0
+    rpc_stats_t
+      //! Call statistics
+      stats[RPC_STATS_SIZE];
+    uint32_t
+      //! Number of calls not counted because the statistics table is full
+      stats_dropped;
+#endif
+
+#if RPC_TRACE_SIZE > 0
+    rpc_trace_t
+      //! Ring buffer with the last requests
+      trace[RPC_TRACE_SIZE];
+    uint8_t
+      //! Position of the next record in the ring buffer
+      trace_index,
+      //! Number of records in the ring buffer
+      trace_count;
+#endif
+
+    ArduRPCContext
+      //! Context used if no other context is given
+      default_context,
+      //! Context of the request currently processed or NULL for the default context
+      *_context;
+
     // internal stuff
     uint8_t
-      //! Current position in the data buffer while reading data
-      cur_data_read_pos,
-      //! Current position in the result buffer while reading data
-      cur_result_read_pos,
-      //! Number of connected handlers
-      handler_index,
-      //! Number of connected functions
+      //! Number of used slots in the function list
       function_index,
       //! Maximum number of connected handlers
       max_handler_count,
       //! Maximum number of connected functions
-      max_function_count;
+      max_function_count,
+      //! Maximum number of subscriptions
+      max_subscription_count,
+      //! The subscription to check next
+      subscription_index;
 };
 
 /**
@@ -288,7 +750,8 @@ class ArduRPCHandler
       setRPC(ArduRPC &rpc),
       setRPC(ArduRPC *rpc);
     virtual uint8_t
-      call(uint8_t cmd_id) = 0;
+      call(uint8_t cmd_id),
+      call(ArduRPCContext *ctx, uint8_t cmd_id);
     uint16_t
       //! Type of the handler
       type;
@@ -297,16 +760,77 @@ class ArduRPCHandler
       *_rpc;
 };
 
+/**
+ * Reference handler for the Extended Pixel Strip.
+ *
+ * All commands write into a framebuffer with color_count bytes for every
+ * pixel. Override show() to send the framebuffer to the LEDs.
+ */
+class ArduRPCHandler_PixelStrip : public ArduRPCHandler
+{
+  public:
+    ArduRPCHandler_PixelStrip(uint8_t *framebuffer, uint16_t pixel_count, uint8_t color_count);
+    uint8_t
+      call(ArduRPCContext *ctx, uint8_t cmd_id);
+    virtual void
+      show();
+  protected:
+    uint8_t
+      //! Colors of all pixels, color_count bytes for every pixel
+      *framebuffer,
+      //! Number of colors of every pixel
+      color_count;
+    uint16_t
+      //! Number of pixels
+      pixel_count;
+};
+
+/**
+ * Reference handler for the Extended Matrix.
+ *
+ * The getters, drawPixel, drawFastVLine, drawFastHLine, fillRect,
+ * fillScreen, drawImage and drawEncodedImage write into a framebuffer with
+ * color_count bytes for every pixel, row by row. Override show() to send the
+ * framebuffer to the display.
+ */
+class ArduRPCHandler_Matrix : public ArduRPCHandler
+{
+  public:
+    ArduRPCHandler_Matrix(uint8_t *framebuffer, uint16_t width, uint16_t height, uint8_t color_count);
+    uint8_t
+      call(ArduRPCContext *ctx, uint8_t cmd_id);
+    virtual void
+      show();
+  protected:
+    void
+      fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint8_t *color);
+    uint8_t
+      //! Colors of all pixels, color_count bytes for every pixel
+      *framebuffer,
+      //! Number of colors of every pixel
+      color_count;
+    uint16_t
+      //! Width in pixels
+      width,
+      //! Height in pixels
+      height;
+};
+
+//! Time budget of ArduRPC_Serial without a limit
+#define RPC_SERIAL_NO_LIMIT 0xffffffff
+
 /**
  * Handle serial communication.
  */
-class ArduRPC_Serial
+class ArduRPC_Serial : public ArduRPCResultWriter
 {
   public:
     ArduRPC_Serial(Stream &serial, ArduRPC &rpc);
     void loop();
+    bool poll(uint32_t budget_us, uint32_t *time_used=NULL);
     void processDataHex(uint8_t c);
     void readData();
+    void writeResultChunk(ArduRPCContext *ctx, uint8_t *data, uint8_t length);
   private:
     //! RPC handler to use
     ArduRPC *_rpc;
@@ -318,15 +842,330 @@ class ArduRPC_Serial
     uint8_t _tmp_data;
     //! Data part for hex strings. 0 = part 1 (bits 7-4); 1 = part 2 (bits 3-0)
     uint8_t _tmp_data_part;
-    void processResultHex();
+    //! Number of characters of the result already written
+    uint16_t _result_pos;
+#if RPC_SERIAL_PRIORITY_LENGTH > 0
+    //! Data buffer of the priority lane
+    uint8_t _priority_data[RPC_SERIAL_PRIORITY_LENGTH];
+#if RPC_SHARED_BUFFERS == 0
+    //! Result buffer of the priority lane
+    uint8_t _priority_result[RPC_SERIAL_PRIORITY_LENGTH];
+#endif
+    //! Context of the priority lane
+    ArduRPCContext *_priority_context;
+    //! true while a priority request is received
+    bool _priority_receiving;
+    //! Temporary data of the priority lane
+    uint8_t _priority_tmp_data;
+    //! Data part of the priority lane
+    uint8_t _priority_tmp_data_part;
+#endif
+    bool
+      processResultHex(uint32_t start, uint32_t budget_us),
+      receiveHex(uint8_t c, ArduRPCContext *ctx, uint8_t *tmp_data, uint8_t *tmp_data_part),
+      receivePriority(uint8_t c);
+    void
+      finishRequest(),
+      processRequest(),
+      processSubscriptions(),
+      readPriority(),
+      startRequest(),
+      writeHex(uint8_t *data, uint8_t len);
 };
 
+//! Counters of a port of ArduRPC_SimLink
+typedef struct {
+  //! Bytes written to the port
+  uint32_t sent;
+  //! Written bytes lost on the line
+  uint32_t lost;
+  //! Written bytes with a flipped bit
+  uint32_t corrupted;
+  //! Bytes received and stored in the receive buffer
+  uint32_t received;
+  //! Received bytes dropped because the receive buffer was full
+  uint32_t overflows;
+} rpc_sim_link_stats_t;
+
+//! Byte on the line of ArduRPC_SimLink
+typedef struct {
+  //! Time the byte arrives in microseconds
+  uint32_t time;
+  //! The data
+  uint8_t data;
+} rpc_sim_link_byte_t;
+
+class ArduRPC_SimLink;
+
+/**
+ * One end of a simulated serial link.
+ */
+class ArduRPC_SimLinkPort : public Stream
+{
+  public:
+    ArduRPC_SimLinkPort();
+    ~ArduRPC_SimLinkPort();
+    int available();
+    int peek();
+    int read();
+    size_t write(uint8_t c);
+    using Print::write;
+    rpc_sim_link_stats_t *getStats();
+  private:
+    friend class ArduRPC_SimLink;
+    void
+      init(ArduRPC_SimLink *link, ArduRPC_SimLinkPort *peer, uint16_t buffer_size, uint16_t line_size),
+      update();
+    //! The link
+    ArduRPC_SimLink *_link;
+    //! The other end of the link
+    ArduRPC_SimLinkPort *_peer;
+    //! Counters
+    rpc_sim_link_stats_t _stats;
+    //! Receive buffer
+    uint8_t *_buffer;
+    //! Bytes sent by the peer but not received yet
+    rpc_sim_link_byte_t *_line;
+    uint16_t
+      //! Size of the receive buffer
+      _buffer_size,
+      //! Position of the first byte in the receive buffer
+      _buffer_pos,
+      //! Number of bytes in the receive buffer
+      _buffer_count,
+      //! Maximum number of bytes on the line
+      _line_size,
+      //! Position of the first byte on the line
+      _line_pos,
+      //! Number of bytes on the line
+      _line_count;
+    //! Time the port has finished sending the last byte
+    uint32_t _time_free;
+};
+
+/**
+ * Simulated serial link connecting two Streams.
+ *
+ * Bytes written to one port are received by the other port after the time
+ * needed to transfer them with the given baud rate (8N1) and the latency.
+ */
+class ArduRPC_SimLink
+{
+  public:
+    ArduRPC_SimLink(uint32_t baud, uint32_t latency=0, uint16_t buffer_size=64, uint16_t line_size=256);
+    void setErrorRates(uint16_t loss_rate, uint16_t corruption_rate, uint32_t seed=1);
+    //! First end of the link
+    ArduRPC_SimLinkPort a;
+    //! Second end of the link
+    ArduRPC_SimLinkPort b;
+  private:
+    friend class ArduRPC_SimLinkPort;
+    uint32_t random();
+    uint32_t
+      //! Time to transfer one byte in microseconds
+      _byte_time,
+      //! Propagation delay in microseconds
+      _latency,
+      //! State of the pseudo random number generator
+      _random_state;
+    uint16_t
+      //! Lost bytes per 65536 bytes
+      _loss_rate,
+      //! Corrupted bytes per 65536 bytes
+      _corruption_rate;
+};
+
+#if RPC_NETWORK > 0
+//! State of a connection handled by ArduRPC_Network
+typedef struct {
+  //! The connection or NULL if the slot is free
+  Client *client;
+  //! Index of the context used to receive a request or 0xff
+  uint8_t context_id;
+  //! Internal processing state
+  uint8_t state;
+  //! Temporary data
+  uint8_t tmp_data;
+  //! Data part for hex strings. 0 = part 1 (bits 7-4); 1 = part 2 (bits 3-0)
+  uint8_t tmp_data_part;
+  //! Data received after a pending request, processed after the request has been completed
+  uint8_t stash[RPC_NETWORK_CHUNK_SIZE];
+  //! Number of bytes in the stash
+  uint8_t stash_length;
+} rpc_network_connection_t;
+
+/**
+ * Handle multiple network connections, e.g. from an EthernetServer or WiFiServer.
+ *
+ * Every connection uses the same hex encoding as ArduRPC_Serial. Idle
+ * connections only need a few bytes of memory. A context is taken from a
+ * small shared pool while a request is received and processed.
+ */
+class ArduRPC_Network : public ArduRPCResultWriter
+{
+  public:
+    ArduRPC_Network(ArduRPC &rpc, uint8_t max_connections=4);
+    bool attach(Client &client);
+    uint8_t getConnectionCount();
+    void readData();
+    void writeResultChunk(ArduRPCContext *ctx, uint8_t *data, uint8_t length);
+  private:
+    void
+      processConnection(rpc_network_connection_t *connection),
+      processResultHex(Client *client, ArduRPCContext *ctx),
+      writeFrameHex(Client *client, char start, uint8_t *data, uint8_t length),
+      releaseConnection(rpc_network_connection_t *connection);
+    //! RPC handler to use
+    ArduRPC *_rpc;
+    //! List of connections
+    rpc_network_connection_t *_connections;
+    //! Contexts shared by all connections
+    ArduRPCContext *_contexts[RPC_NETWORK_CONTEXT_COUNT];
+    //! Bitmask of contexts in use
+    uint8_t _contexts_used;
+    //! Maximum number of connections
+    uint8_t _max_connections;
+};
+#endif
+
+#if defined(__linux__)
+//! State of a socket handled by ArduRPC_Socket
+typedef struct {
+  //! The file descriptor
+  int fd;
+  //! true if the socket accepts new connections
+  bool listener;
+  //! Internal processing state
+  uint8_t state;
+  //! Temporary data
+  uint8_t tmp_data;
+  //! Data part for hex strings. 0 = part 1 (bits 7-4); 1 = part 2 (bits 3-0)
+  uint8_t tmp_data_part;
+  //! The epoll events the socket has been registered for
+  uint32_t events;
+  //! Context used to receive a request or NULL
+  ArduRPCContext *ctx;
+  //! Data not sent yet
+  uint8_t *output;
+  //! Number of bytes not sent yet
+  uint32_t output_length;
+  //! Size of the output buffer
+  uint32_t output_size;
+} rpc_socket_connection_t;
+
+/**
+ * Serve Unix domain and TCP sockets with an epoll event loop on Linux.
+ *
+ * Every connection uses the same hex encoding as ArduRPC_Serial. Only
+ * sockets with events are processed, idle connections only cost a few bytes.
+ * A context is taken from a pool while a request is received and processed.
+ * Pending requests are not allowed.
+ */
+class ArduRPC_Socket : public ArduRPCResultWriter
+{
+  public:
+    ArduRPC_Socket(ArduRPC &rpc, uint32_t max_connections=1024);
+    bool
+      listenTCP(uint16_t port, const char *address="127.0.0.1"),
+      listenUnix(const char *path);
+    int
+      poll(int timeout_ms);
+    uint32_t
+      getConnectionCount();
+    void
+      writeResultChunk(ArduRPCContext *ctx, uint8_t *data, uint8_t length);
+  private:
+    bool
+      addSocket(int fd, bool listener),
+      flushOutput(rpc_socket_connection_t *connection),
+      processConnection(rpc_socket_connection_t *connection),
+      updateEvents(rpc_socket_connection_t *connection),
+      writeFrameHex(rpc_socket_connection_t *connection, char start, uint8_t *data, uint8_t length);
+    void
+      acceptConnections(rpc_socket_connection_t *listener),
+      closeConnection(rpc_socket_connection_t *connection),
+      releaseContext(rpc_socket_connection_t *connection);
+    //! RPC handler to use
+    ArduRPC *_rpc;
+    //! The epoll file descriptor
+    int _epoll_fd;
+    //! Connection of the request processed at the moment
+    rpc_socket_connection_t *_current;
+    //! Unused contexts
+    ArduRPCContext **_contexts;
+    //! Number of unused contexts
+    uint32_t _context_count;
+    //! Size of the list of unused contexts
+    uint32_t _context_size;
+    //! Number of open connections
+    uint32_t _connection_count;
+    //! Maximum number of connections
+    uint32_t _max_connections;
+};
+#endif
+
+/**
+ * A value of a result found by ArduRPCResultParser.
+ *
+ * The pointers point into the parsed buffer. The value is only valid as long
+ * as the buffer is not changed.
+ */
+typedef struct {
+  //! The type of the value. See RPC_INT8 ... RPC_VARRAY
+  uint8_t type;
+  //! Number of columns: 1 for RPC_ARRAY, the number of columns for RPC_MCARRAY and 0 for all other types
+  uint8_t columns;
+  //! Number of characters of RPC_STRING, elements of RPC_ARRAY and rows of RPC_MCARRAY
+  uint8_t count;
+  //! Number of bytes of the data
+  uint8_t length;
+  //! The types of the elements of RPC_ARRAY and of the columns of RPC_MCARRAY or NULL
+  uint8_t *types;
+  //! The data without type and header. The values of RPC_VARRAY keep their types
+  uint8_t *data;
+} rpc_value_t;
+
+/**
+ * Parse the values of a result without copying them.
+ */
+class ArduRPCResultParser
+{
+  public:
+    ArduRPCResultParser(uint8_t *data, uint8_t length);
+    bool
+      next(rpc_value_t *value);
+    uint8_t
+      getError(),
+      getPosition();
+    static float
+      getFloat(rpc_value_t *value);
+    static int32_t
+      getInt32(rpc_value_t *value);
+    static uint32_t
+      getUint32(rpc_value_t *value);
+  private:
+    uint8_t
+      //! The data to parse
+      *_data,
+      //! Number of bytes of the data
+      _length,
+      //! Position of the next value
+      _pos,
+      //! 0x02 if the data is invalid
+      _error;
+};
+
+class ArduRPCRequestCoalescer;
+
 class ArduRPCRequest
 {
   public:
     ArduRPCRequest();
     bool
       call(uint8_t, uint8_t),
+      discover(rpc_discovery_cache_t *cache),
+      readResult_value(rpc_value_t *value),
+      send(uint8_t, uint8_t),
       setHandler(void *),
       writeRequest(uint8_t c),
       writeRequest_float(float value),
@@ -337,22 +1176,40 @@ class ArduRPCRequest
       writeRequest_uint8(uint8_t value),
       writeRequest_uint16(uint16_t value),
       writeRequest_uint32(uint32_t value),
+      writeRequest_varint(int32_t value),
+      writeRequest_varuint(uint32_t value),
+      flushResult(),
       writeResult(uint8_t c);
+    uint16_t
+      writeRequest_encodedPixels(uint8_t *frame, uint8_t *previous, uint16_t start, uint16_t count, uint8_t color_count),
+      writeRequest_pixels(uint8_t *frame, uint16_t start, uint16_t count, uint8_t color_count);
+    float
+      readResult_float();
     int8_t
       readResult_int8();
     int16_t
       readResult_int16();
     int32_t
-      readResult_int32();
+      readResult_int32(),
+      readResult_varint();
     void
-      reset();
+      reset(),
+      setCoalescer(ArduRPCRequestCoalescer *coalescer),
+      setResultPartCallback(rpc_result_part_callback_t callback, void *arg),
+      setReturnCode(uint8_t code);
     void
       *handler;
     uint8_t
       getConnectionError(),
       getError(),
-      getResultCurrentData(uint8_t **);
+      getResultCurrentData(uint8_t **),
+      getState(),
+      poll(),
+      subscribe(uint8_t handler_id, uint8_t cmd_id, uint16_t interval, float threshold, uint8_t *params, uint8_t param_length),
+      unsubscribe(uint8_t subscription_id);
     uint8_t
+      readResult_array(void *dst, uint8_t type, uint8_t max_count),
+      readResult_columns(void **columns, uint8_t column_count, uint8_t max_rows),
       readResult_raw_uint8(),
       readResult_string(char *, uint8_t),
       readResult_type(uint8_t),
@@ -360,11 +1217,32 @@ class ArduRPCRequest
     uint16_t
       readResult_uint16();
     uint32_t
-      readResult_uint32();
+      readResult_uint32(),
+      readResult_raw_varuint(),
+      readResult_varuint();
       //readResult();
+    template<typename... Args>
+      bool call(uint8_t handler_id, uint8_t cmd_id, Args... args);
+    template<typename R, typename... Args>
+      R invoke(uint8_t handler_id, uint8_t cmd_id, Args... args);
+    template<typename... Results>
+      bool readResults(Results &... results);
+    template<typename... Args>
+      bool writeRequest_values(Args... args);
     uint8_t
       return_code;
   private:
+    uint8_t
+      *readResult_fixed(uint8_t type, uint8_t size);
+    ArduRPCRequestCoalescer
+      //! Flushed before a new request is started
+      *coalescer;
+    rpc_result_part_callback_t
+      //! Function to pass the data of a result sent in parts to or NULL
+      part_callback;
+    void
+      //! Argument passed to the part callback
+      *part_arg;
     rpc_result_t
       //! Result buffer
       result;
@@ -375,6 +1253,8 @@ class ArduRPCRequest
     // internal stuff
     uint8_t
       error,
+      //! State of the request. See RPC_REQUEST_STATE_*
+      state,
       //! Current position in the data buffer while reading data
       cur_request_read_pos,
       //! Current position in the result buffer while reading data
@@ -396,6 +1276,7 @@ class ArduRPCRequestConnection
     virtual void reset() = 0;
     virtual void send(rpc_data_t ) = 0;
     virtual bool waitResult() = 0;
+    virtual uint8_t poll();
     uint8_t
       getError();
     uint8_t error;
@@ -414,11 +1295,33 @@ class ArduRPCRequest_Serial : public ArduRPCRequestConnection
     void reset();
     void send(rpc_data_t request);
     bool waitResult();
+    uint8_t poll();
+    void setNotificationCallback(rpc_notification_callback_t callback, void *arg);
+    //! Send requests as priority requests ('*')
+    bool priority;
   private:
     bool processDataHex(uint8_t c);
     //! Serial port to use
     Stream *_serial;
-    //! Internal processing state
+    //! Time the last request has been sent
+    unsigned long _time_start;
+    //! true if a request has been sent and the result is not available yet
+    bool _waiting;
+    //! true if parts of the result have been received
+    bool _streamed;
+    //! true if the next byte is the return code of a result sent in parts
+    bool _code_pending;
+    //! true if the last request has been sent as priority request
+    bool _priority_sent;
+    //! Function to call if a notification has been received
+    rpc_notification_callback_t _notification_callback;
+    //! Argument passed to the notification callback
+    void *_notification_arg;
+    //! Buffer for the notification
+    uint8_t _notification[RPC_MAX_NOTIFICATION_LENGTH];
+    //! Number of bytes in the notification buffer
+    uint8_t _notification_length;
+    //! Internal processing state. 0 = idle; 1 = result; 2 = notification; 3 = part of a result; 4 = result of the other lane
     uint8_t _state;
     //! Temporary data
     uint8_t _tmp_data;
@@ -427,10 +1330,212 @@ class ArduRPCRequest_Serial : public ArduRPCRequestConnection
     //void processResultHex();
 };
 
-//! Callback function for a rpc function
-typedef uint8_t (*rpc_callback_function_t)(ArduRPC *rpc, void *);
-//! Callback function for a rpc handler
-typedef uint8_t (*rpc_callback_handler_t)(uint8_t, ArduRPC *rpc, void *);
+/**
+ * Drive many requests from one loop.
+ *
+ * Every request uses its own connection e.g. to talk to a different device.
+ * The requests are sent with ArduRPCRequest::send() and the results are
+ * collected by poll() or wait(). The timeout of every connection is handled
+ * without delay().
+ *
+ * The connections are polled round-robin, there is no OS poll() or epoll.
+ * It is meant for the Stream based connections of a microcontroller, waiting
+ * on file descriptors of a host is not supported.
+ */
+class ArduRPCRequestMultiplexer
+{
+  public:
+    ArduRPCRequestMultiplexer(uint8_t max_request_count=8);
+    bool
+      add(ArduRPCRequest &request),
+      remove(ArduRPCRequest &request),
+      wait();
+    uint8_t
+      getRequestCount(),
+      poll();
+    ArduRPCRequest
+      *getRequest(uint8_t i);
+  private:
+    //! List of requests
+    ArduRPCRequest **_requests;
+    //! Number of requests in the list
+    uint8_t _request_count;
+    //! Maximum number of requests
+    uint8_t _max_request_count;
+};
+
+//! No draw command is buffered
+#define RPC_COALESCE_NONE 0
+//! A run of pixels of a pixel strip is buffered
+#define RPC_COALESCE_STRIP 1
+//! A rectangle of pixels of a matrix is buffered
+#define RPC_COALESCE_MATRIX 2
+
+/**
+ * Merge draw commands into fewer requests.
+ *
+ * Pixels with the same color are buffered as long as they extend the current
+ * run. A run of a pixel strip is sent with setRangeColor, a run of a matrix
+ * with drawFastHLine, drawFastVLine or fillRect of the Extended Matrix.
+ *
+ * The buffered pixels are sent if a pixel does not extend the run, if
+ * max_pixels or max_delay have been reached, on flush() and before the
+ * request is reset to send any other command.
+ */
+class ArduRPCRequestCoalescer
+{
+  public:
+    ArduRPCRequestCoalescer(ArduRPCRequest &request);
+    bool
+      drawPixel(uint8_t handler_id, int16_t x, int16_t y, uint8_t color1, uint8_t color2, uint8_t color3),
+      flush(),
+      poll(),
+      setPixelColor(uint8_t handler_id, uint16_t n, uint8_t color1, uint8_t color2, uint8_t color3);
+    uint16_t
+      //! Maximum number of pixels to buffer
+      max_pixels,
+      //! Maximum time in milliseconds to buffer pixels. 0 = until flush() is called
+      max_delay;
+  private:
+    bool
+      sendRect(int16_t x, int16_t y, uint16_t width, uint16_t height);
+    ArduRPCRequest
+      //! The request used to send the commands
+      *_request;
+    uint8_t
+      //! The buffered command. See RPC_COALESCE_*
+      _kind,
+      //! The ID of the handler
+      _handler_id,
+      //! The color of the pixels
+      _color[3];
+    int16_t
+      //! Matrix: position of the upper-left pixel
+      _x,
+      _y;
+    uint16_t
+      //! Pixel strip: index of the first pixel
+      _index,
+      //! Number of pixels in a row
+      _width,
+      //! Number of rows, the last row may be incomplete
+      _height,
+      //! Number of pixels in the last row
+      _last_width,
+      //! Number of buffered pixels
+      _pixels;
+    unsigned long
+      //! Time the first pixel has been buffered
+      _start_time;
+};
+
+/**
+ * Shadow framebuffer of a matrix on the client.
+ *
+ * The application draws into the local framebuffer. Only pixels changing
+ * their color are marked as dirty. flush() sends the dirty rectangles with
+ * fillRect if all pixels have the same color or with drawImage otherwise.
+ * The handler must be an Extended Matrix.
+ */
+class ArduRPCRequestFramebuffer
+{
+  public:
+    ArduRPCRequestFramebuffer(ArduRPCRequest &request, uint8_t handler_id);
+    ~ArduRPCRequestFramebuffer();
+    bool
+      begin(),
+      flush();
+    uint8_t
+      getColorCount(),
+      *getPixel(int16_t x, int16_t y);
+    uint16_t
+      getHeight(),
+      getWidth();
+    void
+      drawPixel(int16_t x, int16_t y, uint8_t color1, uint8_t color2, uint8_t color3),
+      fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint8_t color1, uint8_t color2, uint8_t color3),
+      fillScreen(uint8_t color1, uint8_t color2, uint8_t color3),
+      invalidate();
+    uint8_t
+      //! Color encoding of drawImage. 0 = 8-Bit, 1 = 16-Bit, 2 = 24-Bit
+      color_encoding;
+  private:
+    bool
+      isUniform(uint16_t x, uint16_t y, uint16_t w, uint16_t h),
+      sendImage(uint16_t x, uint16_t y, uint16_t w, uint16_t h),
+      sendRect(uint16_t x, uint16_t y, uint16_t w, uint16_t h);
+    void
+      markDirty(uint16_t x0, uint16_t x1, uint16_t y);
+    ArduRPCRequest
+      //! The request used to send the commands
+      *_request;
+    uint8_t
+      //! The ID of the matrix handler
+      _handler_id,
+      //! Number of colors of every pixel
+      _color_count,
+      //! Colors of all pixels, color_count bytes for every pixel
+      *_pixels;
+    uint16_t
+      //! Width of the matrix
+      _width,
+      //! Height of the matrix
+      _height,
+      //! First dirty pixel of every row. width = the row is clean
+      *_dirty_x0,
+      //! Last dirty pixel of every row
+      *_dirty_x1;
+};
+
+/**
+ * Convert a hex character into its value
+ * @param c The character ('0'-'9', 'a'-'f' or 'A'-'F')
+ * @return The value of the character
+ */
+static inline uint8_t rpc_hex_decode(uint8_t c)
+{
+  if(c >= 97) {
+    return c - 87;
+  } else if(c >= 65) {
+    return c - 55;
+  }
+  return c - 48;
+}
+
+/**
+ * Convert the lower four bits into an upper case hex character
+ * @param value The value
+ * @return The hex character
+ */
+static inline char rpc_hex_encode(uint8_t value)
+{
+  value &= 0x0f;
+  if(value < 10) {
+    return '0' + value;
+  }
+  return 'A' + value - 10;
+}
+
+/**
+ * Map a signed value to an unsigned value using the zigzag encoding.
+ * Small negative and positive values result in small unsigned values.
+ * @param value The signed value
+ * @return The encoded value
+ */
+static inline uint32_t rpc_zigzag_encode(int32_t value)
+{
+  return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+/**
+ * Map a zigzag encoded value back to the signed value.
+ * @param value The encoded value
+ * @return The signed value
+ */
+static inline int32_t rpc_zigzag_decode(uint32_t value)
+{
+  return (int32_t)((value >> 1) ^ (0 - (value & 1)));
+}
 
 /**
  * Extract one byte from given data
@@ -532,4 +1637,270 @@ static inline uint32_t rpc_read_uint32(void *data)
   res = res | d[3];
   return res;
 }
+
+/**
+ * Extract a float from given data
+ * @param data array
+ * @return Extracted data
+ */
+static inline float rpc_read_float(void *data)
+{
+  float res;
+  uint8_t *d = (uint8_t *)data;
+  uint8_t *v = (uint8_t *)&res;
+  v[3] = d[0];
+  v[2] = d[1];
+  v[1] = d[2];
+  v[0] = d[3];
+  return res;
+}
+
+/**
+ * Get the number of bytes of a value without the type identifier.
+ * @param type The type of the value
+ * @return Number of bytes or 0 if the type has no fixed size
+ */
+static inline uint8_t rpc_type_size(uint8_t type)
+{
+  switch (type) {
+    case RPC_INT8:
+    case RPC_UINT8:
+      return 1;
+    case RPC_INT16:
+    case RPC_UINT16:
+      return 2;
+    case RPC_INT32:
+    case RPC_UINT32:
+    case RPC_FLOAT:
+      return 4;
+    case RPC_INT64:
+    case RPC_UINT64:
+      return 8;
+  }
+  return 0;
+}
+
+/**
+ * Encoding of a value passed to ArduRPCRequest::call() and
+ * ArduRPCRequest::invoke().
+ *
+ * Every specialization provides the type of the value in a result, the number
+ * of bytes of the value without the type and functions to write and read the
+ * value. Only types with a fixed size are supported.
+ */
+template<typename T> struct rpc_value_traits;
+
+template<> struct rpc_value_traits<int8_t>
+{
+  static const uint8_t type = RPC_INT8;
+  static const uint8_t size = 1;
+  static inline void write(uint8_t *dst, int8_t value) { dst[0] = value; }
+  static inline int8_t read(uint8_t *src) { return rpc_read_int8(src); }
+};
+
+template<> struct rpc_value_traits<uint8_t>
+{
+  static const uint8_t type = RPC_UINT8;
+  static const uint8_t size = 1;
+  static inline void write(uint8_t *dst, uint8_t value) { dst[0] = value; }
+  static inline uint8_t read(uint8_t *src) { return rpc_read_uint8(src); }
+};
+
+template<> struct rpc_value_traits<int16_t>
+{
+  static const uint8_t type = RPC_INT16;
+  static const uint8_t size = 2;
+  static inline void write(uint8_t *dst, int16_t value)
+  {
+    dst[0] = (value >> 8) & 0xff;
+    dst[1] = value & 0xff;
+  }
+  static inline int16_t read(uint8_t *src) { return rpc_read_int16(src); }
+};
+
+template<> struct rpc_value_traits<uint16_t>
+{
+  static const uint8_t type = RPC_UINT16;
+  static const uint8_t size = 2;
+  static inline void write(uint8_t *dst, uint16_t value)
+  {
+    dst[0] = (value >> 8) & 0xff;
+    dst[1] = value & 0xff;
+  }
+  static inline uint16_t read(uint8_t *src) { return rpc_read_uint16(src); }
+};
+
+template<> struct rpc_value_traits<int32_t>
+{
+  static const uint8_t type = RPC_INT32;
+  static const uint8_t size = 4;
+  static inline void write(uint8_t *dst, int32_t value)
+  {
+    dst[0] = (value >> 24) & 0xff;
+    dst[1] = (value >> 16) & 0xff;
+    dst[2] = (value >> 8) & 0xff;
+    dst[3] = value & 0xff;
+  }
+  static inline int32_t read(uint8_t *src) { return rpc_read_int32(src); }
+};
+
+template<> struct rpc_value_traits<uint32_t>
+{
+  static const uint8_t type = RPC_UINT32;
+  static const uint8_t size = 4;
+  static inline void write(uint8_t *dst, uint32_t value)
+  {
+    dst[0] = (value >> 24) & 0xff;
+    dst[1] = (value >> 16) & 0xff;
+    dst[2] = (value >> 8) & 0xff;
+    dst[3] = value & 0xff;
+  }
+  static inline uint32_t read(uint8_t *src) { return rpc_read_uint32(src); }
+};
+
+template<> struct rpc_value_traits<float>
+{
+  static const uint8_t type = RPC_FLOAT;
+  static const uint8_t size = 4;
+  static inline void write(uint8_t *dst, float value)
+  {
+    uint8_t *v = (uint8_t *)&value;
+    dst[0] = v[3];
+    dst[1] = v[2];
+    dst[2] = v[1];
+    dst[3] = v[0];
+  }
+  static inline float read(uint8_t *src) { return rpc_read_float(src); }
+};
+
+/**
+ * Encoding of a list of values.
+ *
+ * The sizes are known at compile time. size is the number of bytes of all
+ * parameters in a request, result_size the number of bytes of all values
+ * including their types in a result.
+ */
+template<typename... T> struct rpc_value_list;
+
+template<> struct rpc_value_list<>
+{
+  static const uint16_t size = 0;
+  static const uint16_t result_size = 0;
+  static inline void write(uint8_t *) {}
+  static inline bool check(uint8_t *) { return true; }
+  static inline void read(uint8_t *) {}
+};
+
+template<typename T, typename... R> struct rpc_value_list<T, R...>
+{
+  static const uint16_t size = rpc_value_traits<T>::size + rpc_value_list<R...>::size;
+  static const uint16_t result_size = 1 + rpc_value_traits<T>::size + rpc_value_list<R...>::result_size;
+  static inline void write(uint8_t *dst, T value, R... rest)
+  {
+    rpc_value_traits<T>::write(dst, value);
+    rpc_value_list<R...>::write(dst + rpc_value_traits<T>::size, rest...);
+  }
+  static inline bool check(uint8_t *src)
+  {
+    return src[0] == rpc_value_traits<T>::type &&
+      rpc_value_list<R...>::check(src + 1 + rpc_value_traits<T>::size);
+  }
+  static inline void read(uint8_t *src, T &value, R &... rest)
+  {
+    value = rpc_value_traits<T>::read(src + 1);
+    rpc_value_list<R...>::read(src + 1 + rpc_value_traits<T>::size, rest...);
+  }
+};
+
+/**
+ * Write the parameters of the request and send it and wait for the result.
+ *
+ * The request buffer is reset before the parameters are written. The
+ * parameters are written without their type as expected by the commands.
+ * Pass every value with the exact type the command expects, e.g.
+ * (uint16_t)300, the size of int depends on the platform.
+ *
+ * @param handler_id The ID of the handler
+ * @param cmd_id The ID of the command
+ * @param args The parameters
+ * @return true if the result has been received
+ */
+template<typename... Args>
+bool ArduRPCRequest::call(uint8_t handler_id, uint8_t cmd_id, Args... args)
+{
+  this->reset();
+  if (!this->writeRequest_values(args...)) {
+    this->state = RPC_REQUEST_STATE_ERROR;
+    return false;
+  }
+  return this->call(handler_id, cmd_id);
+}
+
+/**
+ * Call a command and return its result.
+ *
+ * @see call()
+ * @param handler_id The ID of the handler
+ * @param cmd_id The ID of the command
+ * @param args The parameters
+ * @return The result or R() if the call failed. Check getError() and return_code
+ */
+template<typename R, typename... Args>
+R ArduRPCRequest::invoke(uint8_t handler_id, uint8_t cmd_id, Args... args)
+{
+  R value = R();
+
+  if (this->template call<Args...>(handler_id, cmd_id, args...) && this->return_code == RPC_RETURN_SUCCESS) {
+    this->readResults(value);
+  }
+  return value;
+}
+
+/**
+ * Read the next values of the result.
+ *
+ * The types and the length of all values are checked at once before any
+ * value is read. Sets the error 0x02 if they do not match the result.
+ *
+ * @param results The variables to read the values into
+ * @return true on success | false if the result does not match
+ */
+template<typename... Results>
+bool ArduRPCRequest::readResults(Results &... results)
+{
+  uint8_t *data = &this->result.data[this->cur_result_read_pos];
+
+  if (this->error > 0) {
+    return false;
+  }
+  if (this->result.length - this->cur_result_read_pos < rpc_value_list<Results...>::result_size ||
+      !rpc_value_list<Results...>::check(data)) {
+    this->error = 0x02;
+    return false;
+  }
+  rpc_value_list<Results...>::read(data, results...);
+  this->cur_result_read_pos += rpc_value_list<Results...>::result_size;
+  return true;
+}
+
+/**
+ * Write parameters into the request buffer.
+ *
+ * The size of all values is checked at once. Sets the error 0x04 if they do
+ * not fit into the buffer.
+ *
+ * @param args The values to write
+ * @return true on success | false if the values do not fit
+ */
+template<typename... Args>
+bool ArduRPCRequest::writeRequest_values(Args... args)
+{
+  if (this->request.length + rpc_value_list<Args...>::size > RPC_MAX_DATA_LENGTH - 1) {
+    this->error = 0x04;
+    return false;
+  }
+  rpc_value_list<Args...>::write(&this->request.data[this->request.length], args...);
+  this->request.length += rpc_value_list<Args...>::size;
+  return true;
+}
 #endif
@@ -0,0 +1,126 @@
+/**
+ * Arduino Remote Procedure Calls - ArduRPC
+ * Copyright (C) 2013-2016 DinoTools
+ *
+ * This file is part of ArduRPC.
+ *
+ * ArduRPC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * ArduRPC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ArduRPC.h"
+
+
+//! Function called while waiting in rpc_delay()
+static rpc_idle_callback_t rpc_idle_callback = NULL;
+//! Argument passed to the idle callback
+static void *rpc_idle_arg = NULL;
+
+#ifdef RPC_VIRTUAL_CLOCK
+//! Time of the virtual clock in microseconds
+static uint32_t rpc_clock_us = 0;
+//! Time of the virtual clock in milliseconds
+static uint32_t rpc_clock_ms = 0;
+//! Microseconds not counted in rpc_clock_ms yet
+static uint16_t rpc_clock_us_rest = 0;
+
+/**
+ * Get the time of the virtual clock.
+ *
+ * Used by RPC_MICROS() if RPC_VIRTUAL_CLOCK is defined.
+ *
+ * @return Microseconds since the start
+ */
+uint32_t rpc_clock_micros()
+{
+  return rpc_clock_us;
+}
+
+/**
+ * Get the time of the virtual clock.
+ *
+ * Used by RPC_MILLIS() if RPC_VIRTUAL_CLOCK is defined.
+ *
+ * @return Milliseconds since the start
+ */
+uint32_t rpc_clock_millis()
+{
+  return rpc_clock_ms;
+}
+
+/**
+ * Advance the virtual clock.
+ *
+ * The clock only changes if this function is called. Simulations call it in
+ * their main loop to run faster than real time and with the same timing on
+ * every run.
+ *
+ * @param us Microseconds to advance
+ */
+void rpc_clock_advance(uint32_t us)
+{
+  rpc_clock_us += us;
+  rpc_clock_ms += us / 1000;
+  rpc_clock_us_rest += us % 1000;
+  if (rpc_clock_us_rest >= 1000) {
+    rpc_clock_ms++;
+    rpc_clock_us_rest -= 1000;
+  }
+}
+#endif
+
+/**
+ * Wait the given time.
+ *
+ * The idle callback is called repeatedly while waiting. With RPC_VIRTUAL_CLOCK
+ * the clock is advanced by RPC_VIRTUAL_CLOCK_STEP after every call of the
+ * callback.
+ *
+ * @param ms Milliseconds to wait
+ */
+void rpc_delay(uint32_t ms)
+{
+  uint32_t start;
+
+  if (rpc_idle_callback == NULL) {
+#ifdef RPC_VIRTUAL_CLOCK
+    rpc_clock_advance(ms * 1000);
+#else
+    delay(ms);
+#endif
+    return;
+  }
+
+  start = RPC_MILLIS();
+  do {
+    rpc_idle_callback(rpc_idle_arg);
+#ifdef RPC_VIRTUAL_CLOCK
+    rpc_clock_advance(RPC_VIRTUAL_CLOCK_STEP);
+#endif
+  } while (RPC_MILLIS() - start < ms);
+}
+
+/**
+ * Set the function called while waiting in rpc_delay().
+ *
+ * A simulation can use it to run the other end of a link while a blocking
+ * call like ArduRPCRequest::call() waits for the result.
+ *
+ * @param callback The function or NULL to disable it
+ * @param arg Argument passed to the function
+ */
+void rpc_set_idle_callback(rpc_idle_callback_t callback, void *arg)
+{
+  rpc_idle_callback = callback;
+  rpc_idle_arg = arg;
+}
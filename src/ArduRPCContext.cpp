@@ -0,0 +1,887 @@
+/**
+ * Arduino Remote Procedure Calls - ArduRPC
+ * Copyright (C) 2013-2016 DinoTools
+ *
+ * This file is part of ArduRPC.
+ *
+ * ArduRPC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * ArduRPC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public 
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ArduRPC.h"
+
+/**
+ * The constructor allocates the data and the result buffer.
+ *
+ * The size of the buffers is given by RPC_MAX_DATA_LENGTH and
+ * RPC_MAX_RESULT_LENGTH.
+ */
+ArduRPCContext::ArduRPCContext()
+{
+  this->data.data = (uint8_t *)malloc(RPC_MAX_DATA_LENGTH);
+#if RPC_SHARED_BUFFERS == 1
+  this->result.data = this->data.data;
+#else
+  this->result.data = (uint8_t *)malloc(RPC_MAX_RESULT_LENGTH);
+#endif
+  this->data_size = RPC_MAX_DATA_LENGTH;
+  this->result_size = RPC_MAX_RESULT_LENGTH;
+  this->result_writer = NULL;
+  this->pending_allowed = false;
+  this->reset();
+}
+
+/**
+ * Use the given memory as data and result buffer.
+ *
+ * Both pointers may point to the same memory to share the buffers.
+ *
+ * @param data Buffer for the request data, at least RPC_MAX_DATA_LENGTH bytes
+ * @param result Buffer for the result, at least RPC_MAX_RESULT_LENGTH bytes
+ */
+ArduRPCContext::ArduRPCContext(uint8_t *data, uint8_t *result)
+{
+  this->data.data = data;
+  this->result.data = result;
+  this->data_size = RPC_MAX_DATA_LENGTH;
+  this->result_size = RPC_MAX_RESULT_LENGTH;
+  this->result_writer = NULL;
+  this->pending_allowed = false;
+  this->reset();
+}
+
+/**
+ * Use the given memory of the given size as data and result buffer.
+ *
+ * Both pointers may point to the same memory to share the buffers. Smaller
+ * buffers are useful for contexts only processing short requests.
+ *
+ * @param data Buffer for the request data
+ * @param result Buffer for the result
+ * @param data_size Size of the data buffer
+ * @param result_size Size of the result buffer
+ */
+ArduRPCContext::ArduRPCContext(uint8_t *data, uint8_t *result, uint16_t data_size, uint16_t result_size)
+{
+  this->data.data = data;
+  this->result.data = result;
+  this->data_size = data_size;
+  this->result_size = result_size;
+  this->result_writer = NULL;
+  this->pending_allowed = false;
+  this->reset();
+}
+
+/**
+ * Get the size of the data buffer.
+ * @return Number of bytes
+ */
+uint16_t ArduRPCContext::getDataSize()
+{
+  return this->data_size;
+}
+
+/**
+ * Get the size of the result buffer.
+ * @return Number of bytes
+ */
+uint16_t ArduRPCContext::getResultSize()
+{
+  return this->result_size;
+}
+
+/**
+ * Copy external data into the internal processing buffer
+ * @param src A pointer to the data to copy.
+ * @param len Number of bytes to copy
+ * @return 0 on success | 1 if the data does not fit into the buffer
+ */
+uint8_t ArduRPCContext::copyData(uint8_t *src, uint8_t len)
+{
+  this->data.length = 0;
+  if (!this->reserveData(len)) {
+    return 1;
+  }
+  this->data.length = len;
+  memcpy(this->data.data, src, len);
+  return 0;
+}
+
+/**
+ * Read a character from the current position in the parameter data and return it.
+ * @return A character from the parameter data.
+ */
+char ArduRPCContext::getParam_char()
+{
+  char res = rpc_read_int8(&this->data.data[this->cur_data_read_pos]);
+  this->cur_data_read_pos++;
+  return res;
+}
+
+/**
+ * Read encoded pixel data and write the colors into a framebuffer.
+ *
+ * The framebuffer holds color_count bytes for every pixel. Pixels skipped by
+ * the delta encoding keep their current color.
+ *
+ * Format:
+ *   - uint8 encoding (RPC_PIXEL_ENCODING_*)
+ *   - uint16 index of the first pixel
+ *   - uint8 number of entries
+ *   - entries
+ *     - RAW: color_count bytes for one pixel
+ *     - RLE: uint8 number of pixels, color_count bytes
+ *     - DELTA: uint8 pixels to skip, uint8 number of pixels, color_count bytes
+ *
+ * @param framebuffer The framebuffer.
+ * @param pixel_count The number of pixels in the framebuffer.
+ * @param color_count The number of bytes for every pixel.
+ * @return RPC_RETURN_SUCCESS or RPC_RETURN_INVALID_REQUEST
+ */
+uint8_t ArduRPCContext::getParam_encodedPixels(uint8_t *framebuffer, uint16_t pixel_count, uint8_t color_count)
+{
+  uint8_t encoding;
+  uint8_t entry_count;
+  uint8_t entry_size;
+  uint8_t skip;
+  uint8_t length;
+  uint32_t pos;
+  uint8_t *color;
+  uint8_t *dst;
+
+  if (this->data.length - this->cur_data_read_pos < 4) {
+    return RPC_RETURN_INVALID_REQUEST;
+  }
+  encoding = this->getParam_uint8();
+  pos = this->getParam_uint16();
+  entry_count = this->getParam_uint8();
+
+  entry_size = color_count;
+  if (encoding == RPC_PIXEL_ENCODING_RLE) {
+    entry_size += 1;
+  } else if (encoding == RPC_PIXEL_ENCODING_DELTA) {
+    entry_size += 2;
+  } else if (encoding != RPC_PIXEL_ENCODING_RAW) {
+    return RPC_RETURN_INVALID_REQUEST;
+  }
+  if ((uint16_t)entry_count * entry_size > (uint16_t)(this->data.length - this->cur_data_read_pos)) {
+    return RPC_RETURN_INVALID_REQUEST;
+  }
+
+  for (; entry_count > 0; entry_count--) {
+    skip = 0;
+    length = 1;
+    if (encoding == RPC_PIXEL_ENCODING_DELTA) {
+      skip = this->getParam_uint8();
+    }
+    if (encoding != RPC_PIXEL_ENCODING_RAW) {
+      length = this->getParam_uint8();
+    }
+    color = &this->data.data[this->cur_data_read_pos];
+    this->cur_data_read_pos += color_count;
+
+    pos += skip;
+    if (pos + length > pixel_count) {
+      return RPC_RETURN_INVALID_REQUEST;
+    }
+    dst = &framebuffer[pos * color_count];
+    pos += length;
+    for (; length > 0; length--) {
+      memcpy(dst, color, color_count);
+      dst += color_count;
+    }
+  }
+  return RPC_RETURN_SUCCESS;
+}
+
+/**
+ * Read the colors of consecutive pixels into a framebuffer.
+ *
+ * The parameter is the number of pixels as uint8_t followed by color_count
+ * bytes for every pixel. The colors are copied without decoding.
+ *
+ * @param framebuffer The first pixel to set
+ * @param pixel_count Number of pixels available in the framebuffer
+ * @param color_count Number of colors of every pixel
+ * @return RPC_RETURN_SUCCESS | RPC_RETURN_INVALID_REQUEST if the data is incomplete or does not fit
+ */
+uint8_t ArduRPCContext::getParam_pixels(uint8_t *framebuffer, uint16_t pixel_count, uint8_t color_count)
+{
+  uint8_t count;
+  uint16_t length;
+
+  if (this->data.length - this->cur_data_read_pos < 1) {
+    return RPC_RETURN_INVALID_REQUEST;
+  }
+  count = this->getParam_uint8();
+  length = (uint16_t)count * color_count;
+  if (count > pixel_count || length > (uint16_t)(this->data.length - this->cur_data_read_pos)) {
+    return RPC_RETURN_INVALID_REQUEST;
+  }
+  memcpy(framebuffer, &this->data.data[this->cur_data_read_pos], length);
+  this->cur_data_read_pos += length;
+  return RPC_RETURN_SUCCESS;
+}
+
+/**
+ * Read a float value at the current position in the parameter data and return it.
+ *
+ * @return A float value.
+ */
+float ArduRPCContext::getParam_float()
+{
+  float result;
+  uint8_t *v = (uint8_t *)&result;
+
+  v[3] = this->getParam_uint8();
+  v[2] = this->getParam_uint8();
+  v[1] = this->getParam_uint8();
+  v[0] = this->getParam_uint8();
+
+  return result;
+}
+
+/**
+ * Read a byte from the current position in the parameter data and return it.
+ */
+int8_t ArduRPCContext::getParam_int8()
+{
+  int8_t res = rpc_read_int8(&this->data.data[this->cur_data_read_pos]);
+  this->cur_data_read_pos++;
+  return res;
+}
+
+/**
+ * Read two bytes from the current position in the parameter data and return it.
+ */
+int16_t ArduRPCContext::getParam_int16()
+{
+  int16_t res;
+  res = rpc_read_int16(&this->data.data[this->cur_data_read_pos]);
+  this->cur_data_read_pos += 2;
+  return res;
+}
+
+/**
+ * Read four bytes from the current position in the parameter data and return it.
+ */
+int32_t ArduRPCContext::getParam_int32()
+{
+  int32_t res;
+  res = rpc_read_int32(&this->data.data[this->cur_data_read_pos]);
+  this->cur_data_read_pos += 4;
+  return res;
+}
+
+/**
+ * Read a string from the current position in the parameter data.
+ * @param dst Pointer to the destination.
+ * @param max_length The maximum number of bytes to copy.
+ * @return The number of copyed bytes.
+ */
+uint8_t ArduRPCContext::getParam_string(char *dst, uint8_t max_length)
+{
+  uint8_t length;
+  uint8_t n;
+  n = length = this->getParam_uint8();
+  if(n > max_length) {
+    n = max_length;
+  }
+  memcpy(dst, &this->data.data[this->cur_data_read_pos], n);
+  if(n < max_length) {
+    dst[n] = '\0';
+  }
+  this->cur_data_read_pos += length;
+  return n;
+}
+
+/**
+ * Read a byte from the current position in the parameter data and return it.
+ */
+uint8_t ArduRPCContext::getParam_uint8()
+{
+  uint8_t res = rpc_read_uint8(&this->data.data[this->cur_data_read_pos]);
+  this->cur_data_read_pos++;
+  return res;
+}
+
+/**
+ * Read two bytes from the current position in the parameter data and return it.
+ */
+uint16_t ArduRPCContext::getParam_uint16()
+{
+  uint16_t res;
+  res = rpc_read_uint16(&this->data.data[this->cur_data_read_pos]);
+  this->cur_data_read_pos += 2;
+  return res;
+}
+
+/**
+ * Read four bytes from the current position in the parameter data and return it.
+ */
+uint32_t ArduRPCContext::getParam_uint32()
+{
+  uint32_t res;
+  res = rpc_read_uint32(&this->data.data[this->cur_data_read_pos]);
+  this->cur_data_read_pos += 4;
+  return res;
+}
+
+/**
+ * Read a variable length unsigned integer (LEB128) from the current position in the parameter data and return it.
+ */
+uint32_t ArduRPCContext::getParam_varuint()
+{
+  uint32_t res = 0;
+  uint8_t shift = 0;
+  uint8_t c;
+
+  do {
+    if (this->cur_data_read_pos >= this->data.length) {
+      break;
+    }
+    c = this->data.data[this->cur_data_read_pos++];
+    if (shift < 32) {
+      res |= (uint32_t)(c & 0x7f) << shift;
+    }
+    shift += 7;
+  } while (c & 0x80);
+  return res;
+}
+
+/**
+ * Read a variable length signed integer (zigzag + LEB128) from the current position in the parameter data and return it.
+ */
+int32_t ArduRPCContext::getParam_varint()
+{
+  return rpc_zigzag_decode(this->getParam_varuint());
+}
+
+/**
+ * Return pointer to raw data structure.
+ *
+ * @return Pointer to raw data.
+ */
+rpc_data_t *ArduRPCContext::getRawData()
+{
+  return &this->data;
+}
+
+/**
+ * Return pointer to raw result data.
+ *
+ * @return Pointer to raw result data.
+ */
+rpc_result_t *ArduRPCContext::getRawResult()
+{
+  return &this->result;
+}
+
+/**
+ * Return the length of request parameters in bytes
+ *
+ * @return Parameter length
+ */
+uint8_t ArduRPCContext::getRequestParamLength()
+{
+  // The size of the header is 4 bytes
+  return this->data.length - 4;
+}
+
+/**
+ * Return a pointer to the result data
+ * @return A pointer to the result data
+ */
+uint8_t *ArduRPCContext::getResultData()
+{
+  return (uint8_t *)this->result.data;
+}
+
+/**
+ * Get the length of the result data including the header.
+ * @return The number of bytes of the result data
+ */
+uint8_t ArduRPCContext::getResultLength()
+{
+  return this->result.length + 1;
+}
+
+/**
+ * Get the length of the result data.
+ * @return The number of bytes of the result data
+ */
+uint8_t ArduRPCContext::getResultDataLength()
+{
+  return this->result.length;
+}
+
+/**
+ * Read and return the next byte from the result buffer.
+ * @return The next byte from result buffer.
+ */
+uint8_t ArduRPCContext::readResult()
+{
+  return this->result.data[this->cur_result_read_pos++];
+}
+
+/**
+ * Reset the internal processing and result buffer.
+ * It does *not* remove connected handlers or functions.
+ */
+void ArduRPCContext::reset() {
+  this->overflow_count = 0;
+  this->result_streamed = false;
+  this->pending = false;
+  this->result.length = 0;
+  this->data.length = 0;
+  this->cur_data_read_pos = 0;
+  this->cur_result_read_pos = 0;
+}
+
+/**
+ * Get the number of writes rejected because a buffer was full and clear it.
+ * @return The number of rejected writes since the last call
+ */
+uint8_t ArduRPCContext::takeOverflowCount()
+{
+  uint8_t count = this->overflow_count;
+  this->overflow_count = 0;
+  return count;
+}
+
+/**
+ * Check if the given number of bytes fits into the data buffer.
+ * A failed check is counted as overflow.
+ * @param length The number of bytes to write
+ * @return true if the bytes fit | false if not
+ */
+bool ArduRPCContext::reserveData(uint8_t length)
+{
+  uint16_t end = (uint16_t)this->data.length + length;
+  if (end > this->data_size || end > 0xff) {
+    if (this->overflow_count < 0xff) {
+      this->overflow_count++;
+    }
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Get the number of bytes that can be written into the result buffer.
+ * The return code in front of the result and the uint8 returned by
+ * getResultLength() limit the result to 254 bytes.
+ * @return Number of free bytes
+ */
+uint8_t ArduRPCContext::getResultSpace()
+{
+  uint16_t size = this->result_size;
+  if (size > 0xff) {
+    size = 0xff;
+  }
+  return size - 1 - this->result.length;
+}
+
+/**
+ * Pass the buffered result data to the result writer and empty the buffer.
+ * @return true if the data has been passed | false if no writer is set
+ */
+bool ArduRPCContext::flushResult()
+{
+  if (this->result_writer == NULL || this->result.length == 0) {
+    return false;
+  }
+  this->result_writer->writeResultChunk(this, &this->result.data[1], this->result.length);
+  this->result.length = 0;
+  this->result_streamed = true;
+  return true;
+}
+
+/**
+ * Check if the given number of bytes fits into the result buffer.
+ * If a result writer is set the buffer is flushed to make room.
+ * A failed check is counted as overflow.
+ * @param length The number of bytes to write
+ * @return true if the bytes fit | false if not
+ */
+bool ArduRPCContext::reserveResult(uint16_t length)
+{
+  if (length <= this->getResultSpace()) {
+    return true;
+  }
+  if (this->flushResult() && length <= this->getResultSpace()) {
+    return true;
+  }
+  if (this->overflow_count < 0xff) {
+    this->overflow_count++;
+  }
+  return false;
+}
+
+/**
+ * Check if the request is waiting for the handler to complete it.
+ * @see ArduRPC::complete()
+ * @return true if the request is pending
+ */
+bool ArduRPCContext::isPending()
+{
+  return this->pending;
+}
+
+/**
+ * Check if the handler may complete the request later.
+ *
+ * Handlers must check this before they return RPC_RETURN_PENDING. If it is
+ * not allowed they have to complete the request before they return.
+ *
+ * @return true if the transport supports pending requests
+ */
+bool ArduRPCContext::isPendingAllowed()
+{
+  return this->pending_allowed;
+}
+
+/**
+ * Mark the request as pending or completed.
+ * @param pending true if the handler completes the request later
+ */
+void ArduRPCContext::setPending(bool pending)
+{
+  this->pending = pending;
+}
+
+/**
+ * Allow handlers to complete requests processed with this context later.
+ *
+ * Only set by transports that wait for ArduRPC::complete() and send the
+ * result afterwards.
+ *
+ * @param allowed true if pending requests are supported
+ */
+void ArduRPCContext::setPendingAllowed(bool allowed)
+{
+  this->pending_allowed = allowed;
+}
+
+/**
+ * Check if parts of the result have already been passed to the result writer.
+ * @return true if the result has been streamed
+ */
+bool ArduRPCContext::isResultStreamed()
+{
+  return this->result_streamed;
+}
+
+/**
+ * Set the transport to send the result in chunks to.
+ *
+ * Without a writer the result is limited by the size of the result buffer.
+ * With a writer the buffer is passed to the writer every time it is full.
+ * Only the data after the last chunk and the return code remain in the
+ * buffer after the request has been processed.
+ *
+ * @param writer The writer or NULL
+ */
+void ArduRPCContext::setResultWriter(ArduRPCResultWriter *writer)
+{
+  this->result_writer = writer;
+}
+
+/**
+ * Set the return code.
+ * @param code The return code
+ */
+void ArduRPCContext::setReturnCode(uint8_t code)
+{
+  this->result.data[0] = code;
+}
+
+/**
+ * Write a byte into the data buffer.
+ * @param c The byte to write.
+ * @return true on success | false if the buffer is full
+ */
+bool ArduRPCContext::writeData(uint8_t c)
+{
+  if (!this->reserveData(1)) {
+    return false;
+  }
+  this->data.data[this->data.length] = c;
+  this->data.length++;
+  return true;
+}
+
+/**
+ * Write a byte into the result buffer.
+ * @param c The byte to write.
+ * @return true on success | false if the buffer is full
+ */
+bool ArduRPCContext::writeResult(uint8_t c)
+{
+  if (!this->reserveResult(1)) {
+    return false;
+  }
+  this->result.length++;
+  this->result.data[this->result.length] = c;
+  return true;
+}
+
+/**
+ * Write a string into the result buffer.
+ *
+ * Data longer than the result buffer is passed to the result writer in parts.
+ *
+ * @param string A pointer to the string.
+ * @param length The length of the string to copy.
+ * @return true on success | false if the buffer is full
+ */
+bool ArduRPCContext::writeResult(char *string, uint16_t length)
+{
+  uint8_t n;
+
+  while (length > 0) {
+    n = this->getResultSpace();
+    if (n == 0 && this->flushResult()) {
+      continue;
+    }
+    if (n == 0) {
+      if (this->overflow_count < 0xff) {
+        this->overflow_count++;
+      }
+      return false;
+    }
+    if (n > length) {
+      n = length;
+    }
+    memcpy(&this->result.data[this->result.length + 1], string, n);
+    this->result.length += n;
+    string += n;
+    length -= n;
+  }
+  return true;
+}
+
+/**
+ * Copy data stored in flash (PROGMEM) into the result buffer.
+ * @param data A pointer to the data in flash.
+ * @param length The number of bytes to copy.
+ * @return true on success | false if the buffer is full
+ */
+bool ArduRPCContext::writeResult_P(const uint8_t *data, uint8_t length)
+{
+  uint8_t n;
+
+  while (length > 0) {
+    n = this->getResultSpace();
+    if (n == 0 && this->flushResult()) {
+      continue;
+    }
+    if (n == 0) {
+      if (this->overflow_count < 0xff) {
+        this->overflow_count++;
+      }
+      return false;
+    }
+    if (n > length) {
+      n = length;
+    }
+    memcpy_P(&this->result.data[this->result.length + 1], data, n);
+    this->result.length += n;
+    data += n;
+    length -= n;
+  }
+  return true;
+}
+
+/**
+ * Write a value of type FLOAT
+ * @param value The value to write.
+ * @return true on success | false if the value does not fit
+ */
+bool ArduRPCContext::writeResult_float(float value)
+{
+  uint8_t *v = (uint8_t *)&value;
+  if (!this->reserveResult(1 + 4)) {
+    return false;
+  }
+  this->writeResult(RPC_FLOAT);
+  this->writeResult(v[3]);
+  this->writeResult(v[2]);
+  this->writeResult(v[1]);
+  this->writeResult(v[0]);
+  return true;
+}
+
+/**
+ * Write a value of type INT8
+ * @param value The value to write.
+ * @return true on success | false if the value does not fit
+ */
+bool ArduRPCContext::writeResult_int8(int8_t value)
+{
+  if (!this->reserveResult(1 + 1)) {
+    return false;
+  }
+  this->writeResult(RPC_INT8);
+  this->writeResult(value);
+  return true;
+}
+
+/**
+ * Write a value of type INT16
+ * @param value The value to write.
+ * @return true on success | false if the value does not fit
+ */
+bool ArduRPCContext::writeResult_int16(int16_t value)
+{
+  if (!this->reserveResult(1 + 2)) {
+    return false;
+  }
+  this->writeResult(RPC_INT16);
+  this->writeResult((((value) >> 8) & 0xff));
+  this->writeResult(((value) & 0xff));
+  return true;
+}
+
+/**
+ * Write a value of type INT32
+ * @param value The value to write.
+ * @return true on success | false if the value does not fit
+ */
+bool ArduRPCContext::writeResult_int32(int32_t value)
+{
+  if (!this->reserveResult(1 + 4)) {
+    return false;
+  }
+  this->writeResult(RPC_INT32);
+  this->writeResult((((value) >> 24) & 0xff));
+  this->writeResult((((value) >> 16) & 0xff));
+  this->writeResult((((value) >> 8) & 0xff));
+  this->writeResult(((value) & 0xff));
+  return true;
+}
+
+/**
+ * Write a value of type STRING
+ *
+ * Without a result writer the whole string must fit into the buffer. With a
+ * result writer a long string is sent in parts.
+ *
+ * @param value The value to write.
+ * @param length The string length.
+ * @return true on success | false if the value does not fit
+ */
+bool ArduRPCContext::writeResult_string(char *value, uint8_t length)
+{
+  if (!this->reserveResult(this->result_writer == NULL ? 2 + length : 2)) {
+    return false;
+  }
+  this->writeResult(RPC_STRING);
+  this->writeResult(length);
+  return this->writeResult(value, length);
+}
+
+/**
+ * Write a value of type UINT8
+ * @param value The value to write.
+ * @return true on success | false if the value does not fit
+ */
+bool ArduRPCContext::writeResult_uint8(uint8_t value)
+{
+  if (!this->reserveResult(1 + 1)) {
+    return false;
+  }
+  this->writeResult(RPC_UINT8);
+  this->writeResult(value);
+  return true;
+}
+
+/**
+ * Write a value of type UINT16
+ * @param value The value to write.
+ * @return true on success | false if the value does not fit
+ */
+bool ArduRPCContext::writeResult_uint16(uint16_t value)
+{
+  if (!this->reserveResult(1 + 2)) {
+    return false;
+  }
+  this->writeResult(RPC_UINT16);
+  this->writeResult((((value) >> 8) & 0xff));
+  this->writeResult(((value) & 0xff));
+  return true;
+}
+
+/**
+ * Write a value of type UINT32
+ * @param value The value to write.
+ * @return true on success | false if the value does not fit
+ */
+bool ArduRPCContext::writeResult_uint32(uint32_t value)
+{
+  if (!this->reserveResult(1 + 4)) {
+    return false;
+  }
+  this->writeResult(RPC_UINT32);
+  this->writeResult((((value) >> 24) & 0xff));
+  this->writeResult((((value) >> 16) & 0xff));
+  this->writeResult((((value) >> 8) & 0xff));
+  this->writeResult(((value) & 0xff));
+  return true;
+}
+
+/**
+ * Write a value of type VARINT
+ * @param value The value to write.
+ * @return true on success | false if the value does not fit
+ */
+bool ArduRPCContext::writeResult_varint(int32_t value)
+{
+  return this->writeResult_raw_varuint(RPC_VARINT, rpc_zigzag_encode(value));
+}
+
+/**
+ * Write a value of type VARUINT
+ * @param value The value to write.
+ * @return true on success | false if the value does not fit
+ */
+bool ArduRPCContext::writeResult_varuint(uint32_t value)
+{
+  return this->writeResult_raw_varuint(RPC_VARUINT, value);
+}
+
+/**
+ * Write a type identifier followed by a variable length unsigned integer (LEB128)
+ * @param type The type identifier.
+ * @param value The value to write.
+ * @return true on success | false if the value does not fit
+ */
+bool ArduRPCContext::writeResult_raw_varuint(uint8_t type, uint32_t value)
+{
+  uint8_t size = 2;
+  uint32_t v;
+
+  for (v = value; v >= 0x80; v >>= 7) {
+    size++;
+  }
+  if (!this->reserveResult(size)) {
+    return false;
+  }
+  this->writeResult(type);
+  while (value >= 0x80) {
+    this->writeResult((uint8_t)(value | 0x80));
+    value >>= 7;
+  }
+  this->writeResult((uint8_t)value);
+  return true;
+}
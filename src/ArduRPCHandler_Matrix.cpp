@@ -0,0 +1,207 @@
+/**
+ * Arduino Remote Procedure Calls - ArduRPC
+ * Copyright (C) 2013-2016 DinoTools
+ *
+ * This file is part of ArduRPC.
+ *
+ * ArduRPC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * ArduRPC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "ArduRPC.h"
+
+/**
+ * The constructor.
+ *
+ * @param framebuffer Colors of all pixels, color_count bytes for every pixel
+ * @param width Width in pixels
+ * @param height Height in pixels
+ * @param color_count Number of colors of every pixel. 1, 2 or 3
+ */
+ArduRPCHandler_Matrix::ArduRPCHandler_Matrix(uint8_t *framebuffer, uint16_t width, uint16_t height, uint8_t color_count)
+{
+  this->type = 0x0280;
+  this->framebuffer = framebuffer;
+  this->width = width;
+  this->height = height;
+  this->color_count = color_count;
+}
+
+/**
+ * Call a command of the matrix.
+ *
+ * All drawing commands call show() after the pixels have been set. Pixels
+ * outside of the matrix are ignored.
+ *
+ * @param ctx The context of the request
+ * @param cmd_id The ID of the command
+ * @return The return code
+ */
+uint8_t ArduRPCHandler_Matrix::call(ArduRPCContext *ctx, uint8_t cmd_id)
+{
+  uint8_t color[3];
+  uint8_t encoding;
+  uint8_t pixel_size;
+  uint8_t res;
+  int16_t x;
+  int16_t y;
+  int16_t w = 1;
+  int16_t h = 1;
+  int16_t i;
+  int16_t j;
+  uint16_t value;
+  uint32_t pixel_count;
+
+  if (cmd_id == 0x01) {
+    /* getColorCount() */
+    ctx->writeResult_uint8(this->color_count);
+    return RPC_RETURN_SUCCESS;
+  } else if (cmd_id == 0x02) {
+    /* getWidth() */
+    ctx->writeResult_uint16(this->width);
+    return RPC_RETURN_SUCCESS;
+  } else if (cmd_id == 0x03) {
+    /* getHeight() */
+    ctx->writeResult_uint16(this->height);
+    return RPC_RETURN_SUCCESS;
+  } else if (cmd_id == 0x11 || cmd_id == 0x22 || cmd_id == 0x23 || cmd_id == 0x25) {
+    /* drawPixel(), drawFastVLine(), drawFastHLine() and fillRect() */
+    if (ctx->getRequestParamLength() < (cmd_id == 0x11 ? 7 : cmd_id == 0x25 ? 11 : 9)) {
+      return RPC_RETURN_INVALID_REQUEST;
+    }
+    x = ctx->getParam_int16();
+    y = ctx->getParam_int16();
+    if (cmd_id == 0x22) {
+      h = ctx->getParam_int16();
+    } else if (cmd_id == 0x23) {
+      w = ctx->getParam_int16();
+    } else if (cmd_id == 0x25) {
+      w = ctx->getParam_int16();
+      h = ctx->getParam_int16();
+    }
+    color[0] = ctx->getParam_uint8();
+    color[1] = ctx->getParam_uint8();
+    color[2] = ctx->getParam_uint8();
+    this->fillRect(x, y, w, h, color);
+    this->show();
+    return RPC_RETURN_SUCCESS;
+  } else if (cmd_id == 0x26) {
+    /* fillScreen() */
+    if (ctx->getRequestParamLength() < 3) {
+      return RPC_RETURN_INVALID_REQUEST;
+    }
+    color[0] = ctx->getParam_uint8();
+    color[1] = ctx->getParam_uint8();
+    color[2] = ctx->getParam_uint8();
+    this->fillRect(0, 0, this->width, this->height, color);
+    this->show();
+    return RPC_RETURN_SUCCESS;
+  } else if (cmd_id == 0x61) {
+    /* drawImage() */
+    if (ctx->getRequestParamLength() < 9) {
+      return RPC_RETURN_INVALID_REQUEST;
+    }
+    x = ctx->getParam_int16();
+    y = ctx->getParam_int16();
+    w = ctx->getParam_int16();
+    h = ctx->getParam_int16();
+    encoding = ctx->getParam_uint8();
+    if (w < 0 || h < 0 || encoding > 2) {
+      return RPC_RETURN_INVALID_REQUEST;
+    }
+    pixel_size = encoding + 1;
+    if ((uint32_t)w * h * pixel_size > (uint32_t)(ctx->getRequestParamLength() - 9)) {
+      return RPC_RETURN_INVALID_REQUEST;
+    }
+    for (j = 0; j < h; j++) {
+      for (i = 0; i < w; i++) {
+        if (encoding == 0) {
+          value = ctx->getParam_uint8();
+          color[0] = value & 0xc0;
+          color[1] = (value << 2) & 0xe0;
+          color[2] = (value << 5) & 0xe0;
+        } else if (encoding == 1) {
+          value = ctx->getParam_uint16();
+          color[0] = (value >> 8) & 0xf8;
+          color[1] = (value >> 3) & 0xfc;
+          color[2] = (value << 3) & 0xf8;
+        } else {
+          color[0] = ctx->getParam_uint8();
+          color[1] = ctx->getParam_uint8();
+          color[2] = ctx->getParam_uint8();
+        }
+        this->fillRect(x + i, y + j, 1, 1, color);
+      }
+    }
+    this->show();
+    return RPC_RETURN_SUCCESS;
+  } else if (cmd_id == 0x62) {
+    /* drawEncodedImage() */
+    // getParam_encodedPixels() addresses up to 0xffff pixels
+    pixel_count = (uint32_t)this->width * this->height;
+    if (pixel_count > 0xffff) {
+      pixel_count = 0xffff;
+    }
+    res = ctx->getParam_encodedPixels(this->framebuffer, pixel_count, this->color_count);
+    if (res == RPC_RETURN_SUCCESS) {
+      this->show();
+    }
+    return res;
+  }
+  return RPC_RETURN_COMMAND_NOT_FOUND;
+}
+
+/**
+ * Fill a rectangle of the framebuffer with one color.
+ *
+ * The rectangle is clipped to the matrix.
+ *
+ * @param x The x position
+ * @param y The y position
+ * @param w The width
+ * @param h The height
+ * @param color The color with color_count bytes
+ */
+void ArduRPCHandler_Matrix::fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint8_t *color)
+{
+  int32_t x0 = x < 0 ? 0 : x;
+  int32_t y0 = y < 0 ? 0 : y;
+  int32_t x1 = (int32_t)x + w;
+  int32_t y1 = (int32_t)y + h;
+  int32_t i;
+  uint8_t *dst;
+
+  if (x1 > this->width) {
+    x1 = this->width;
+  }
+  if (y1 > this->height) {
+    y1 = this->height;
+  }
+  for (; y0 < y1; y0++) {
+    dst = &this->framebuffer[((uint32_t)y0 * this->width + x0) * this->color_count];
+    for (i = x0; i < x1; i++) {
+      memcpy(dst, color, this->color_count);
+      dst += this->color_count;
+    }
+  }
+}
+
+/**
+ * Send the framebuffer to the display.
+ *
+ * The default implementation does nothing.
+ */
+void ArduRPCHandler_Matrix::show()
+{
+}
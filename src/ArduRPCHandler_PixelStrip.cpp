@@ -0,0 +1,127 @@
+/**
+ * Arduino Remote Procedure Calls - ArduRPC
+ * Copyright (C) 2013-2016 DinoTools
+ *
+ * This file is part of ArduRPC.
+ *
+ * ArduRPC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * ArduRPC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "ArduRPC.h"
+
+/**
+ * The constructor.
+ *
+ * @param framebuffer Colors of all pixels, color_count bytes for every pixel
+ * @param pixel_count Number of pixels
+ * @param color_count Number of colors of every pixel. 1, 2 or 3
+ */
+ArduRPCHandler_PixelStrip::ArduRPCHandler_PixelStrip(uint8_t *framebuffer, uint16_t pixel_count, uint8_t color_count)
+{
+  this->type = 0x0180;
+  this->framebuffer = framebuffer;
+  this->pixel_count = pixel_count;
+  this->color_count = color_count;
+}
+
+/**
+ * Call a command of the pixel strip.
+ *
+ * setPixelColor, setRangeColor and setEncodedPixels call show() after the
+ * pixels have been set. setPixels only calls it if the show flag is set.
+ *
+ * @param ctx The context of the request
+ * @param cmd_id The ID of the command
+ * @return The return code
+ */
+uint8_t ArduRPCHandler_PixelStrip::call(ArduRPCContext *ctx, uint8_t cmd_id)
+{
+  uint8_t color[3];
+  uint8_t flags;
+  uint8_t res;
+  uint16_t start;
+  uint16_t end;
+  uint16_t count;
+  uint8_t *dst;
+
+  if (cmd_id == 0x01) {
+    /* getColorCount() */
+    ctx->writeResult_uint8(this->color_count);
+    return RPC_RETURN_SUCCESS;
+  } else if (cmd_id == 0x02) {
+    /* getPixelCount() */
+    ctx->writeResult_uint16(this->pixel_count);
+    return RPC_RETURN_SUCCESS;
+  } else if (cmd_id == 0x11 || cmd_id == 0x12) {
+    /* setPixelColor() and setRangeColor() */
+    if (ctx->getRequestParamLength() < (cmd_id == 0x11 ? 5 : 7)) {
+      return RPC_RETURN_INVALID_REQUEST;
+    }
+    start = ctx->getParam_uint16();
+    end = start;
+    if (cmd_id == 0x12) {
+      end = ctx->getParam_uint16();
+    }
+    color[0] = ctx->getParam_uint8();
+    color[1] = ctx->getParam_uint8();
+    color[2] = ctx->getParam_uint8();
+    if (start > end || end >= this->pixel_count) {
+      return RPC_RETURN_INVALID_REQUEST;
+    }
+    dst = &this->framebuffer[(uint32_t)start * this->color_count];
+    for (count = end - start + 1; count > 0; count--) {
+      memcpy(dst, color, this->color_count);
+      dst += this->color_count;
+    }
+    this->show();
+    return RPC_RETURN_SUCCESS;
+  } else if (cmd_id == 0x13) {
+    /* setEncodedPixels() */
+    res = ctx->getParam_encodedPixels(this->framebuffer, this->pixel_count, this->color_count);
+    if (res == RPC_RETURN_SUCCESS) {
+      this->show();
+    }
+    return res;
+  } else if (cmd_id == 0x14) {
+    /* setPixels() */
+    if (ctx->getRequestParamLength() < 3) {
+      return RPC_RETURN_INVALID_REQUEST;
+    }
+    start = ctx->getParam_uint16();
+    flags = ctx->getParam_uint8();
+    if (start >= this->pixel_count) {
+      return RPC_RETURN_INVALID_REQUEST;
+    }
+    res = ctx->getParam_pixels(
+      &this->framebuffer[(uint32_t)start * this->color_count],
+      this->pixel_count - start,
+      this->color_count
+    );
+    if (res == RPC_RETURN_SUCCESS && (flags & RPC_PIXEL_STRIP_SHOW)) {
+      this->show();
+    }
+    return res;
+  }
+  return RPC_RETURN_COMMAND_NOT_FOUND;
+}
+
+/**
+ * Send the framebuffer to the LEDs.
+ *
+ * The default implementation does nothing.
+ */
+void ArduRPCHandler_PixelStrip::show()
+{
+}
@@ -20,6 +20,107 @@
 
 #include "ArduRPC.h"
 
+//! Number of result bytes the buffer and its uint8_t length can hold
+#if RPC_MAX_RESULT_LENGTH < 0xff
+#define RPC_REQUEST_MAX_RESULT_LENGTH RPC_MAX_RESULT_LENGTH
+#else
+#define RPC_REQUEST_MAX_RESULT_LENGTH 0xff
+#endif
+
+/**
+ * Encode pixels with the given encoding.
+ *
+ * Encode as many pixels as fit into the given number of bytes.
+ *
+ * @param encoding The encoding (RPC_PIXEL_ENCODING_*)
+ * @param frame Colors of all pixels
+ * @param previous Colors sent before or NULL
+ * @param start The index of the first pixel
+ * @param count The number of pixels
+ * @param color_count The number of bytes for every pixel
+ * @param dst Destination for the encoded data or NULL to calculate the size only
+ * @param max_length Maximum number of bytes
+ * @param length Number of bytes used
+ * @return Number of encoded pixels
+ */
+static uint16_t rpc_encode_pixels(uint8_t encoding, uint8_t *frame, uint8_t *previous, uint16_t start, uint16_t count, uint8_t color_count, uint8_t *dst, uint8_t max_length, uint8_t *length)
+{
+  uint16_t pos = 0;
+  uint16_t end;
+  uint8_t entry_count = 0;
+  uint8_t entry_size;
+  uint8_t skip;
+  uint8_t run;
+  uint8_t *color;
+
+  *length = 0;
+  entry_size = color_count;
+  if (encoding == RPC_PIXEL_ENCODING_RLE) {
+    entry_size += 1;
+  } else if (encoding == RPC_PIXEL_ENCODING_DELTA) {
+    entry_size += 2;
+  }
+  if (max_length < 4) {
+    return 0;
+  }
+  *length = 4;
+
+  frame += start * color_count;
+  if (previous != NULL) {
+    previous += start * color_count;
+  }
+
+  while (pos < count && entry_count < 0xff && *length + entry_size <= max_length) {
+    skip = 0;
+    if (encoding == RPC_PIXEL_ENCODING_DELTA) {
+      while (pos + skip < count && skip < 0xff &&
+             memcmp(&frame[(pos + skip) * color_count], &previous[(pos + skip) * color_count], color_count) == 0) {
+        skip++;
+      }
+      if (pos + skip >= count) {
+        // Nothing changed
+        pos = count;
+        break;
+      }
+    }
+
+    end = pos + skip;
+    color = &frame[end * color_count];
+    run = 1;
+    if (encoding != RPC_PIXEL_ENCODING_RAW) {
+      while (end + run < count && run < 0xff &&
+             memcmp(&frame[(end + run) * color_count], color, color_count) == 0) {
+        run++;
+      }
+    }
+
+    if (dst != NULL) {
+      if (encoding == RPC_PIXEL_ENCODING_DELTA) {
+        dst[*length] = skip;
+        (*length)++;
+      }
+      if (encoding != RPC_PIXEL_ENCODING_RAW) {
+        dst[*length] = run;
+        (*length)++;
+      }
+      memcpy(&dst[*length], color, color_count);
+      *length += color_count;
+    } else {
+      *length += entry_size;
+    }
+    entry_count++;
+    pos = end + run;
+  }
+
+  if (dst != NULL) {
+    dst[0] = encoding;
+    dst[1] = (start >> 8) & 0xff;
+    dst[2] = start & 0xff;
+    dst[3] = entry_count;
+  }
+  return pos;
+}
+
 /**
  * The constructor performs the following tasks.
  *   - Allocate memory for the handler and function list
@@ -27,6 +128,10 @@
  */
 ArduRPCRequest::ArduRPCRequest()
 {
+  this->state = RPC_REQUEST_STATE_IDLE;
+  this->coalescer = NULL;
+  this->part_callback = NULL;
+  this->part_arg = NULL;
   this->request.data = (uint8_t *)malloc(RPC_MAX_DATA_LENGTH);
 #if RPC_SHARED_BUFFERS == 1
   this->result.data = this->request.data;
@@ -35,7 +140,117 @@ ArduRPCRequest::ArduRPCRequest()
 #endif
 }
 
+/**
+ * Send the request and wait for the result.
+ *
+ * @param handler_id The ID of the handler
+ * @param cmd_id The ID of the command
+ * @return true if the result has been received
+ */
 bool ArduRPCRequest::call(uint8_t handler_id, uint8_t cmd_id)
+{
+  this->send(handler_id, cmd_id);
+  ArduRPCRequestConnection *h = (ArduRPCRequestConnection *)this->handler;
+  h->waitResult();
+  if (this->getError() == 0) {
+    this->state = RPC_REQUEST_STATE_DONE;
+    this->return_code = this->readResult_raw_uint8();
+    return true;
+  }
+  this->state = RPC_REQUEST_STATE_ERROR;
+  return false;
+}
+
+/**
+ * Read the handlers and functions of the device if they have changed.
+ *
+ * The fingerprint of the device is compared with the fingerprint of the
+ * cache. If they match, the cache is up to date and only one request has
+ * been sent. Otherwise the handler list, the handler names and the function
+ * list are read into the cache.
+ *
+ * Initialize the fingerprint of a new cache with 0.
+ *
+ * @param cache The cache to check and update
+ * @return true if the cache is up to date | false on error or if the lists do not fit into the cache
+ */
+bool ArduRPCRequest::discover(rpc_discovery_cache_t *cache)
+{
+  uint32_t fingerprint;
+  uint8_t *data;
+  uint8_t count;
+  uint8_t i;
+
+  fingerprint = this->invoke<uint32_t>(0xff, 0x05);
+  if (this->getError() > 0 || this->return_code != RPC_RETURN_SUCCESS) {
+    return false;
+  }
+  if (fingerprint == cache->fingerprint) {
+    return true;
+  }
+  cache->fingerprint = 0;
+
+  if (!this->call<>(0xff, 0x20) || this->return_code != RPC_RETURN_SUCCESS) {
+    return false;
+  }
+  if (this->getResultCurrentData(&data) < 5 || data[0] != RPC_MCARRAY || data[1] != 2 ||
+      data[2] != RPC_UINT8 || data[3] != RPC_UINT16) {
+    this->error = 0x02;
+    return false;
+  }
+  count = data[4];
+  if (count > RPC_DISCOVERY_HANDLER_COUNT || this->getResultCurrentData(&data) < 5 + 3 * count) {
+    return false;
+  }
+  for (i = 0; i < count; i++) {
+    cache->handlers[i].id = data[5 + 3 * i];
+    cache->handlers[i].type = rpc_read_uint16(&data[6 + 3 * i]);
+  }
+  cache->handler_count = count;
+
+  for (i = 0; i < cache->handler_count; i++) {
+    if (!this->call(0xff, 0x21, cache->handlers[i].id) || this->return_code != RPC_RETURN_SUCCESS) {
+      return false;
+    }
+    this->readResult_string(cache->handlers[i].name, RPC_MAX_NAME_LENGTH);
+    cache->handlers[i].name[RPC_MAX_NAME_LENGTH] = '\0';
+    if (this->getError() > 0) {
+      return false;
+    }
+  }
+
+  if (!this->call<>(0xff, 0x10) || this->return_code != RPC_RETURN_SUCCESS) {
+    return false;
+  }
+  if (this->getResultCurrentData(&data) < 5 || data[0] != RPC_MCARRAY || data[1] != 2 ||
+      data[2] != RPC_UINT8 || data[3] != RPC_UINT8) {
+    this->error = 0x02;
+    return false;
+  }
+  count = data[4];
+  if (count > RPC_DISCOVERY_FUNCTION_COUNT || this->getResultCurrentData(&data) < 5 + 2 * count) {
+    return false;
+  }
+  for (i = 0; i < count; i++) {
+    cache->functions[i].id = data[5 + 2 * i];
+    cache->functions[i].type = data[6 + 2 * i];
+  }
+  cache->function_count = count;
+
+  cache->fingerprint = fingerprint;
+  return true;
+}
+
+/**
+ * Send the request without waiting for the result.
+ *
+ * Use poll() to check if the result is available.
+ *
+ * @param handler_id The ID of the handler
+ * @param cmd_id The ID of the command
+ * @return true if the request has been sent
+ */
+bool ArduRPCRequest::send(uint8_t handler_id, uint8_t cmd_id)
 {
   // protocol version
   this->request.data[0] = 0x00;
@@ -45,10 +260,8 @@ bool ArduRPCRequest::call(uint8_t handler_id, uint8_t cmd_id)
   ArduRPCRequestConnection *h = (ArduRPCRequestConnection *)this->handler;
   h->reset();
   h->send(this->request);
-  h->waitResult();
-  if (this->getError() == 0) {
-    this->return_code = this->readResult_raw_uint8();
-  }
+  this->state = RPC_REQUEST_STATE_PENDING;
+  return true;
 }
 
 uint8_t ArduRPCRequest::getConnectionError()
@@ -73,9 +286,223 @@ uint8_t ArduRPCRequest::getResultCurrentData(uint8_t **data)
   return this->result.length - this->cur_result_read_pos;
 }
 
+/**
+ * Get the state of the request.
+ *
+ * @return The state. See RPC_REQUEST_STATE_*
+ */
+uint8_t ArduRPCRequest::getState()
+{
+  return this->state;
+}
+
+/**
+ * Process the received data of a request sent by send().
+ *
+ * This function does not block.
+ *
+ * @return The state. See RPC_REQUEST_STATE_*
+ */
+uint8_t ArduRPCRequest::poll()
+{
+  uint8_t res;
+
+  if (this->state != RPC_REQUEST_STATE_PENDING) {
+    return this->state;
+  }
+
+  ArduRPCRequestConnection *h = (ArduRPCRequestConnection *)this->handler;
+  res = h->poll();
+  if (res == RPC_REQUEST_STATE_DONE) {
+    if (this->getError() != 0) {
+      // e.g. the result did not fit into the buffer
+      res = RPC_REQUEST_STATE_ERROR;
+    } else {
+      this->return_code = this->readResult_raw_uint8();
+    }
+  }
+  if (res != RPC_REQUEST_STATE_PENDING) {
+    this->state = res;
+  }
+  return res;
+}
+
 bool ArduRPCRequest::setHandler(void *handler)
 {
   this->handler = handler;
+  return true;
+}
+
+/**
+ * Convert a column of big-endian values into an array.
+ *
+ * 16bit values are stored as uint16_t and 32bit values as uint32_t. The bits
+ * of a FLOAT are stored unchanged, so the destination can be a float array.
+ *
+ * @param size Number of bytes of every value
+ * @param src The first value
+ * @param stride Number of bytes from one value to the next
+ * @param count Number of values
+ * @param dst The destination array
+ */
+static void rpc_decode_column(uint8_t size, uint8_t *src, uint16_t stride, uint8_t count, void *dst)
+{
+  uint8_t i;
+  uint8_t *d8;
+  uint16_t *d16;
+  uint32_t value;
+
+  switch (size) {
+    case 1:
+      d8 = (uint8_t *)dst;
+      for (i = 0; i < count; i++, src += stride) {
+        d8[i] = src[0];
+      }
+      break;
+    case 2:
+      d16 = (uint16_t *)dst;
+      for (i = 0; i < count; i++, src += stride) {
+        d16[i] = ((uint16_t)src[0] << 8) | src[1];
+      }
+      break;
+    case 4:
+      d8 = (uint8_t *)dst;
+      for (i = 0; i < count; i++, src += stride) {
+        value = rpc_read_uint32(src);
+        memcpy(&d8[i * 4], &value, 4);
+      }
+      break;
+  }
+}
+
+/**
+ * Read a value of type ARRAY into an array.
+ *
+ * Sets the error 0x02 if the result is not an array of the given type and
+ * 0x03 if it has more than max_count elements.
+ *
+ * @param dst The array. The type must have the size of the element type, e.g. int16_t or uint16_t for RPC_INT16
+ * @param type The type of the elements. Only types with a fixed size of 1, 2 or 4 bytes
+ * @param max_count The number of elements dst can hold
+ * @return Number of elements
+ */
+uint8_t ArduRPCRequest::readResult_array(void *dst, uint8_t type, uint8_t max_count)
+{
+  uint8_t *data;
+  uint8_t size;
+  uint8_t count;
+  uint8_t length;
+
+  if (this->error > 0) {
+    return 0;
+  }
+  length = this->getResultCurrentData(&data);
+  size = rpc_type_size(type);
+  if (length < 3 || data[0] != RPC_ARRAY || data[1] != type || size == 0 || size > 4 ||
+      length - 3 < (uint16_t)data[2] * size) {
+    this->error = 0x02;
+    return 0;
+  }
+  count = data[2];
+  if (count > max_count) {
+    this->error = 0x03;
+    return 0;
+  }
+  rpc_decode_column(size, &data[3], size, count, dst);
+  this->cur_result_read_pos += 3 + count * size;
+  return count;
+}
+
+/**
+ * Read a value of type MCARRAY column by column.
+ *
+ * Every column is written into its own array (struct of arrays). The length
+ * and the column types are checked once before the data is converted.
+ *
+ * Sets the error 0x02 if the result is not an array with the given number of
+ * columns or a column type has no fixed size and 0x03 if it has more than
+ * max_rows rows.
+ *
+ * @param columns An array for every column or NULL to skip the column. The type must have the size of the column type
+ * @param column_count The number of columns
+ * @param max_rows The number of rows every array can hold
+ * @return Number of rows
+ */
+uint8_t ArduRPCRequest::readResult_columns(void **columns, uint8_t column_count, uint8_t max_rows)
+{
+  uint8_t *data;
+  uint8_t *types;
+  uint8_t length;
+  uint8_t rows;
+  uint16_t row_size = 0;
+  uint16_t offset = 0;
+  uint8_t size;
+  uint8_t i;
+
+  if (this->error > 0) {
+    return 0;
+  }
+  length = this->getResultCurrentData(&data);
+  if (length < 3 + column_count || data[0] != RPC_MCARRAY || data[1] != column_count) {
+    this->error = 0x02;
+    return 0;
+  }
+  types = &data[2];
+  for (i = 0; i < column_count; i++) {
+    size = rpc_type_size(types[i]);
+    if (size == 0 || size > 4) {
+      this->error = 0x02;
+      return 0;
+    }
+    row_size += size;
+  }
+  rows = data[2 + column_count];
+  if (length - 3 - column_count < (uint16_t)rows * row_size) {
+    this->error = 0x02;
+    return 0;
+  }
+  if (rows > max_rows) {
+    this->error = 0x03;
+    return 0;
+  }
+
+  data += 3 + column_count;
+  for (i = 0; i < column_count; i++) {
+    size = rpc_type_size(types[i]);
+    if (columns[i] != NULL) {
+      rpc_decode_column(size, &data[offset], row_size, rows, columns[i]);
+    }
+    offset += size;
+  }
+  this->cur_result_read_pos += 3 + column_count + rows * row_size;
+  return rows;
+}
+
+/**
+ * Read the next value without copying it.
+ *
+ * Sets the error 0x02 if the value is invalid.
+ *
+ * @see ArduRPCResultParser::next()
+ * @param value The value found. Valid until the next request is sent
+ * @return true if a value has been found | false at the end of the result or on error
+ */
+bool ArduRPCRequest::readResult_value(rpc_value_t *value)
+{
+  uint8_t *data;
+  uint8_t length;
+
+  if (this->error > 0) {
+    return false;
+  }
+  length = this->getResultCurrentData(&data);
+  ArduRPCResultParser parser(data, length);
+  if (!parser.next(value)) {
+    this->error = parser.getError();
+    return false;
+  }
+  this->cur_result_read_pos += parser.getPosition();
+  return true;
 }
 
 uint8_t ArduRPCRequest::readResult_raw_uint8()
@@ -98,41 +525,69 @@ uint8_t ArduRPCRequest::readResult_type(uint8_t type)
   return 0xff;
 }
 
+/**
+ * Check the type and the length of a value with a fixed size.
+ *
+ * Sets the error 0x02 if the type does not match or the value is incomplete.
+ *
+ * @param type The expected type
+ * @param size Number of bytes of the value without type
+ * @return Pointer to the value or NULL on error
+ */
+uint8_t *ArduRPCRequest::readResult_fixed(uint8_t type, uint8_t size)
+{
+  uint8_t *data;
+
+  if (this->error > 0) {
+    return NULL;
+  }
+  if (this->getResultCurrentData(&data) < 1 + size || data[0] != type) {
+    this->error = 0x02;
+    return NULL;
+  }
+  this->cur_result_read_pos += 1 + size;
+  return &data[1];
+}
+
+float ArduRPCRequest::readResult_float()
+{
+  uint8_t *data = this->readResult_fixed(RPC_FLOAT, 4);
+  return data != NULL ? rpc_read_float(data) : 0;
+}
+
 int8_t ArduRPCRequest::readResult_int8()
 {
-  this->readResult_type(RPC_INT8);
-  int8_t res = this->readResult_raw_uint8();
-  return res;
+  uint8_t *data = this->readResult_fixed(RPC_INT8, 1);
+  return data != NULL ? rpc_read_int8(data) : 0;
 }
 
 int16_t ArduRPCRequest::readResult_int16()
 {
-  this->readResult_type(RPC_INT16);
-  int16_t res = this->readResult_raw_uint8();
-  res = res << 8;
-  res = res | this->readResult_raw_uint8();
-  return res;
+  uint8_t *data = this->readResult_fixed(RPC_INT16, 2);
+  return data != NULL ? rpc_read_int16(data) : 0;
 }
 
 int32_t ArduRPCRequest::readResult_int32()
 {
-  this->readResult_type(RPC_INT32);
-  int32_t res = this->readResult_raw_uint8();
-  res = res << 8;
-  res = res | this->readResult_raw_uint8();
-  res = res << 8;
-  res = res | this->readResult_raw_uint8();
-  res = res << 8;
-  res = res | this->readResult_raw_uint8();
-  return res;
+  uint8_t *data = this->readResult_fixed(RPC_INT32, 4);
+  return data != NULL ? rpc_read_int32(data) : 0;
 }
 
 uint8_t ArduRPCRequest::readResult_string(char *dst, uint8_t max_length)
 {
-  this->readResult_type(RPC_STRING);
+  uint8_t *data;
   uint8_t length;
   uint8_t n;
-  n = length = this->readResult_raw_uint8();
+
+  data = this->readResult_fixed(RPC_STRING, 1);
+  if (data == NULL) {
+    return 0;
+  }
+  n = length = data[0];
+  if (this->result.length - this->cur_result_read_pos < length) {
+    this->error = 0x02;
+    return 0;
+  }
   if(n > max_length) {
     n = max_length;
   }
@@ -147,34 +602,116 @@ uint8_t ArduRPCRequest::readResult_string(char *dst, uint8_t max_length)
 
 uint8_t ArduRPCRequest::readResult_uint8()
 {
-  this->readResult_type(RPC_UINT8);
-  uint8_t res = this->readResult_raw_uint8();
-  return res;
+  uint8_t *data = this->readResult_fixed(RPC_UINT8, 1);
+  return data != NULL ? rpc_read_uint8(data) : 0;
 }
 
 uint16_t ArduRPCRequest::readResult_uint16()
 {
-  this->readResult_type(RPC_UINT16);
-  uint16_t res = this->readResult_raw_uint8();
-  res = res << 8;
-  res = res | this->readResult_raw_uint8();
-  return res;
+  uint8_t *data = this->readResult_fixed(RPC_UINT16, 2);
+  return data != NULL ? rpc_read_uint16(data) : 0;
 }
 
 uint32_t ArduRPCRequest::readResult_uint32()
 {
-  this->readResult_type(RPC_UINT32);
-  uint32_t res = this->readResult_raw_uint8();
-  res = res << 8;
-  res = res | this->readResult_raw_uint8();
-  res = res << 8;
-  res = res | this->readResult_raw_uint8();
-  res = res << 8;
-  res = res | this->readResult_raw_uint8();
+  uint8_t *data = this->readResult_fixed(RPC_UINT32, 4);
+  return data != NULL ? rpc_read_uint32(data) : 0;
+}
+
+/**
+ * Subscribe to a command of the remote device.
+ *
+ * The device executes the command periodically and sends notifications. Use
+ * the notification callback of the connection to receive them.
+ *
+ * @param handler_id The ID of the handler
+ * @param cmd_id The ID of the command
+ * @param interval Minimum time between two executions in milliseconds
+ * @param threshold Minimum change of the value to send a notification. 0 = every execution
+ * @param params The parameters passed to the command
+ * @param param_length The number of parameter bytes
+ * @return The ID of the subscription or 0xff on error
+ */
+uint8_t ArduRPCRequest::subscribe(uint8_t handler_id, uint8_t cmd_id, uint16_t interval, float threshold, uint8_t *params, uint8_t param_length)
+{
+  uint8_t i;
+
+  this->reset();
+  this->writeRequest_uint8(handler_id);
+  this->writeRequest_uint8(cmd_id);
+  this->writeRequest_uint16(interval);
+  this->writeRequest_float(threshold);
+  for (i = 0; i < param_length; i++) {
+    this->writeRequest_uint8(params[i]);
+  }
+  if (!this->call(0xff, 0x30) || this->return_code != RPC_RETURN_SUCCESS) {
+    return 0xff;
+  }
+  return this->readResult_uint8();
+}
+
+/**
+ * Remove a subscription from the remote device.
+ *
+ * @param subscription_id The ID returned by subscribe()
+ * @return The ID of the subscription or 0xff on error
+ */
+uint8_t ArduRPCRequest::unsubscribe(uint8_t subscription_id)
+{
+  this->reset();
+  this->writeRequest_uint8(subscription_id);
+  if (!this->call(0xff, 0x31) || this->return_code != RPC_RETURN_SUCCESS) {
+    return 0xff;
+  }
+  return subscription_id;
+}
+
+/**
+ * Read a variable length unsigned integer (LEB128) without type identifier
+ */
+uint32_t ArduRPCRequest::readResult_raw_varuint()
+{
+  uint32_t res = 0;
+  uint8_t shift = 0;
+  uint8_t c;
+
+  do {
+    if (this->cur_result_read_pos >= this->result.length) {
+      this->error = 0x02;
+      return 0;
+    }
+    c = this->readResult_raw_uint8();
+    if (shift < 32) {
+      res |= (uint32_t)(c & 0x7f) << shift;
+    }
+    shift += 7;
+  } while (c & 0x80);
   return res;
 }
 
+/**
+ * Read a value of type VARINT
+ */
+int32_t ArduRPCRequest::readResult_varint()
+{
+  this->readResult_type(RPC_VARINT);
+  return rpc_zigzag_decode(this->readResult_raw_varuint());
+}
+
+/**
+ * Read a value of type VARUINT
+ */
+uint32_t ArduRPCRequest::readResult_varuint()
+{
+  this->readResult_type(RPC_VARUINT);
+  return this->readResult_raw_varuint();
+}
+
 void ArduRPCRequest::reset() {
+  if (this->coalescer != NULL && this->state != RPC_REQUEST_STATE_PENDING) {
+    // Send the buffered draw commands before a new request is written
+    this->coalescer->flush();
+  }
   this->result.length = 0;
   this->request.length = 4;
   this->cur_request_read_pos = 0;
@@ -184,6 +721,16 @@ void ArduRPCRequest::reset() {
   h->reset();
 }
 
+/**
+ * Set the coalescer to flush before a new request is started.
+ *
+ * @param coalescer The coalescer or NULL
+ */
+void ArduRPCRequest::setCoalescer(ArduRPCRequestCoalescer *coalescer)
+{
+  this->coalescer = coalescer;
+}
+
 /**
  * Write a byte into the result buffer.
  * @param c The byte to write.
@@ -192,6 +739,85 @@ bool ArduRPCRequest::writeRequest(uint8_t c)
 {
   this->request.data[this->request.length] = c;
   this->request.length++;
+  return true;
+}
+
+/**
+ * Write encoded pixels.
+ *
+ * The RAW, RLE and, if the previous frame is given, the DELTA encoding are
+ * compared and the one encoding the most pixels with the fewest bytes is used.
+ * If not all pixels fit into the request the remaining pixels must be sent
+ * with another request.
+ *
+ * @param frame Colors of all pixels, color_count bytes for every pixel
+ * @param previous Colors of all pixels sent before or NULL
+ * @param start The index of the first pixel to send
+ * @param count The number of pixels to send
+ * @param color_count The number of bytes for every pixel
+ * @return The number of encoded pixels
+ */
+uint16_t ArduRPCRequest::writeRequest_encodedPixels(uint8_t *frame, uint8_t *previous, uint16_t start, uint16_t count, uint8_t color_count)
+{
+  uint8_t encoding;
+  uint8_t best_encoding = RPC_PIXEL_ENCODING_RAW;
+  uint16_t best_count = 0;
+  uint8_t best_length = 0;
+  uint16_t n;
+  uint8_t length;
+  uint8_t max_length;
+
+  max_length = RPC_MAX_DATA_LENGTH - 1 - this->request.length;
+  for (encoding = RPC_PIXEL_ENCODING_RAW; encoding <= RPC_PIXEL_ENCODING_DELTA; encoding++) {
+    if (encoding == RPC_PIXEL_ENCODING_DELTA && previous == NULL) {
+      break;
+    }
+    n = rpc_encode_pixels(encoding, frame, previous, start, count, color_count, NULL, max_length, &length);
+    if (n > best_count || (n == best_count && length < best_length)) {
+      best_encoding = encoding;
+      best_count = n;
+      best_length = length;
+    }
+  }
+
+  n = rpc_encode_pixels(best_encoding, frame, previous, start, count, color_count, &this->request.data[this->request.length], max_length, &length);
+  this->request.length += length;
+  return n;
+}
+
+/**
+ * Write the colors of consecutive pixels.
+ *
+ * The number of pixels is written followed by the colors. If not all pixels
+ * fit into the request the remaining pixels must be sent with another
+ * request.
+ *
+ * @param frame Colors of all pixels, color_count bytes for every pixel
+ * @param start The index of the first pixel to send
+ * @param count The number of pixels to send
+ * @param color_count The number of bytes for every pixel
+ * @return The number of written pixels
+ */
+uint16_t ArduRPCRequest::writeRequest_pixels(uint8_t *frame, uint16_t start, uint16_t count, uint8_t color_count)
+{
+  uint16_t max_count;
+  uint16_t length;
+
+  if (color_count == 0 || this->request.length >= RPC_MAX_DATA_LENGTH - 1) {
+    return 0;
+  }
+  max_count = (RPC_MAX_DATA_LENGTH - 2 - this->request.length) / color_count;
+  if (count > max_count) {
+    count = max_count;
+  }
+  if (count > 0xff) {
+    count = 0xff;
+  }
+  length = count * color_count;
+  this->writeRequest((uint8_t)count);
+  memcpy(&this->request.data[this->request.length], &frame[(uint32_t)start * color_count], length);
+  this->request.length += length;
+  return count;
 }
 
 /**
@@ -205,6 +831,7 @@ bool ArduRPCRequest::writeRequest_float(float value)
   this->writeRequest(v[2]);
   this->writeRequest(v[1]);
   this->writeRequest(v[0]);
+  return true;
 }
 
 /**
@@ -214,6 +841,7 @@ bool ArduRPCRequest::writeRequest_float(float value)
 bool ArduRPCRequest::writeRequest_int8(int8_t value)
 {
   this->writeRequest(value);
+  return true;
 }
 
 /**
@@ -224,6 +852,7 @@ bool ArduRPCRequest::writeRequest_int16(int16_t value)
 {
   this->writeRequest((((value) >> 8) & 0xff));
   this->writeRequest(((value) & 0xff));
+  return true;
 }
 
 /**
@@ -236,6 +865,7 @@ bool ArduRPCRequest::writeRequest_int32(int32_t value)
   this->writeRequest((((value) >> 16) & 0xff));
   this->writeRequest((((value) >> 8) & 0xff));
   this->writeRequest(((value) & 0xff));
+  return true;
 }
 
 /**
@@ -249,6 +879,7 @@ bool ArduRPCRequest::writeRequest_string(char *s)
   this->writeRequest_uint8(length);
   memcpy(&this->request.data[this->request.length], s, length);
   this->request.length += length;
+  return true;
 }
 
 /**
@@ -258,6 +889,7 @@ bool ArduRPCRequest::writeRequest_string(char *s)
 bool ArduRPCRequest::writeRequest_uint8(uint8_t value)
 {
   this->writeRequest(value);
+  return true;
 }
 
 /**
@@ -268,6 +900,7 @@ bool ArduRPCRequest::writeRequest_uint16(uint16_t value)
 {
   this->writeRequest((((value) >> 8) & 0xff));
   this->writeRequest(((value) & 0xff));
+  return true;
 }
 
 /**
@@ -280,12 +913,101 @@ bool ArduRPCRequest::writeRequest_uint32(uint32_t value)
   this->writeRequest((((value) >> 16) & 0xff));
   this->writeRequest((((value) >> 8) & 0xff));
   this->writeRequest(((value) & 0xff));
+  return true;
+}
+
+/**
+ * Write a value of type VARINT
+ * @param value The value to write.
+ */
+bool ArduRPCRequest::writeRequest_varint(int32_t value)
+{
+  return this->writeRequest_varuint(rpc_zigzag_encode(value));
+}
+
+/**
+ * Write a value of type VARUINT
+ * @param value The value to write.
+ */
+bool ArduRPCRequest::writeRequest_varuint(uint32_t value)
+{
+  while (value >= 0x80) {
+    this->writeRequest((uint8_t)(value | 0x80));
+    value >>= 7;
+  }
+  this->writeRequest((uint8_t)value);
+  return true;
+}
+
+/**
+ * Pass the received result data to the part callback and empty the buffer.
+ *
+ * The first byte of the buffer is kept, it holds the return code. Nothing
+ * is done if no part callback has been set.
+ *
+ * @return true if the data has been passed to the callback | false if no callback is set
+ */
+bool ArduRPCRequest::flushResult()
+{
+  if (this->part_callback == NULL) {
+    return false;
+  }
+  if (this->result.length > 1) {
+    this->part_callback(&this->result.data[1], this->result.length - 1, this->part_arg);
+    this->result.length = 1;
+  }
+  return true;
+}
+
+/**
+ * Set the function to pass the data of results sent in parts to.
+ *
+ * Without a callback a result must fit into the result buffer of the
+ * request, which holds at most 255 bytes. With a callback the data is passed
+ * to the callback whenever a part has been received or the buffer is full.
+ * After the request is done the buffer only holds the return code and the
+ * data received after the last call of the callback.
+ *
+ * @param callback The function to call or NULL
+ * @param arg Argument passed to the callback
+ */
+void ArduRPCRequest::setResultPartCallback(rpc_result_part_callback_t callback, void *arg)
+{
+  this->part_callback = callback;
+  this->part_arg = arg;
 }
 
+/**
+ * Write a byte of the received result into the result buffer.
+ *
+ * If the buffer is full it is passed to the part callback. Sets the error
+ * 0x03 if the result does not fit into the buffer and no part callback is
+ * set.
+ *
+ * @param c The byte to write.
+ * @return true on success | false if the buffer is full
+ */
 bool ArduRPCRequest::writeResult(uint8_t c)
 {
+  if (this->result.length >= RPC_REQUEST_MAX_RESULT_LENGTH && !this->flushResult()) {
+    this->error = 0x03;
+    return false;
+  }
   this->result.data[this->result.length] = c;
   this->result.length++;
+  return true;
+}
+
+/**
+ * Set the return code of a result received in parts.
+ *
+ * The first byte of the result buffer must have been reserved.
+ *
+ * @param code The return code
+ */
+void ArduRPCRequest::setReturnCode(uint8_t code)
+{
+  this->result.data[0] = code;
 }
 
 /**
@@ -302,6 +1024,22 @@ ArduRPCRequestConnection::ArduRPCRequestConnection()
 {
 }
 
+/**
+ * Check if the result is available.
+ *
+ * The default implementation blocks and calls waitResult(). Connections
+ * should override it to process the available data without blocking.
+ *
+ * @return The state. See RPC_REQUEST_STATE_*
+ */
+uint8_t ArduRPCRequestConnection::poll()
+{
+  if (this->waitResult()) {
+    return RPC_REQUEST_STATE_DONE;
+  }
+  return RPC_REQUEST_STATE_ERROR;
+}
+
 uint8_t ArduRPCRequestConnection::getError()
 {
   return this->error;
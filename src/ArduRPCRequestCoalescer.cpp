@@ -0,0 +1,281 @@
+/**
+ * Arduino Remote Procedure Calls - ArduRPC
+ * Copyright (C) 2013-2016 DinoTools
+ *
+ * This file is part of ArduRPC.
+ *
+ * ArduRPC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * ArduRPC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "ArduRPC.h"
+
+//! pixel_strip::setPixelColor
+#define RPC_COALESCE_CMD_SET_PIXEL_COLOR 0x11
+//! pixel_strip::setRangeColor
+#define RPC_COALESCE_CMD_SET_RANGE_COLOR 0x12
+//! matrix_gfx::drawPixel
+#define RPC_COALESCE_CMD_DRAW_PIXEL 0x11
+//! matrix_gfx::drawFastVLine
+#define RPC_COALESCE_CMD_DRAW_FAST_VLINE 0x22
+//! matrix_gfx::drawFastHLine
+#define RPC_COALESCE_CMD_DRAW_FAST_HLINE 0x23
+//! matrix_gfx::fillRect
+#define RPC_COALESCE_CMD_FILL_RECT 0x25
+
+/**
+ * The constructor.
+ *
+ * The coalescer is registered with the request and flushed before the
+ * request is reset to send any other command.
+ *
+ * @param request The request used to send the commands
+ */
+ArduRPCRequestCoalescer::ArduRPCRequestCoalescer(ArduRPCRequest &request)
+{
+  this->_request = &request;
+  this->_kind = RPC_COALESCE_NONE;
+  this->_pixels = 0;
+  this->max_pixels = 0xffff;
+  this->max_delay = 10;
+  request.setCoalescer(this);
+}
+
+/**
+ * Buffer a pixel of a matrix.
+ *
+ * The pixels are merged into a rectangle. The rectangle is filled row by row
+ * from the left to the right. The handler must be an Extended Matrix.
+ *
+ * @param handler_id The ID of the matrix handler
+ * @param x The x position
+ * @param y The y position
+ * @param color1 First color
+ * @param color2 Second color
+ * @param color3 Third color
+ * @return false if buffered pixels could not be sent or the pixel has not been buffered because a request is pending | true on success
+ */
+bool ArduRPCRequestCoalescer::drawPixel(uint8_t handler_id, int16_t x, int16_t y, uint8_t color1, uint8_t color2, uint8_t color3)
+{
+  bool merged = false;
+  bool res = true;
+
+  if (this->_kind == RPC_COALESCE_MATRIX && this->_handler_id == handler_id &&
+      this->_color[0] == color1 && this->_color[1] == color2 && this->_color[2] == color3) {
+    merged = true;
+    if (this->_height == 1 && y == this->_y && x == this->_x + (int16_t)this->_width) {
+      // Extend the first row
+      this->_width++;
+      this->_last_width++;
+    } else if (this->_last_width == this->_width && y == this->_y + (int16_t)this->_height && x == this->_x) {
+      // Start a new row
+      this->_height++;
+      this->_last_width = 1;
+    } else if (this->_last_width < this->_width && y == this->_y + (int16_t)this->_height - 1 &&
+               x == this->_x + (int16_t)this->_last_width) {
+      // Continue the last row
+      this->_last_width++;
+    } else {
+      merged = false;
+    }
+  }
+
+  if (!merged) {
+    res = this->flush();
+    if (this->_kind != RPC_COALESCE_NONE) {
+      // A request is pending, keep the buffered pixels and refuse the new one
+      return false;
+    }
+  }
+
+  if (this->_kind == RPC_COALESCE_NONE) {
+    this->_kind = RPC_COALESCE_MATRIX;
+    this->_handler_id = handler_id;
+    this->_x = x;
+    this->_y = y;
+    this->_width = 1;
+    this->_height = 1;
+    this->_last_width = 1;
+    this->_color[0] = color1;
+    this->_color[1] = color2;
+    this->_color[2] = color3;
+    this->_pixels = 0;
+    this->_start_time = RPC_MILLIS();
+  }
+  this->_pixels++;
+
+  if (!this->poll()) {
+    return false;
+  }
+  return res;
+}
+
+/**
+ * Buffer a pixel of a pixel strip.
+ *
+ * Pixels with consecutive indices are merged into a range.
+ *
+ * @param handler_id The ID of the pixel strip handler
+ * @param n The index of the pixel
+ * @param color1 First color
+ * @param color2 Second color
+ * @param color3 Third color
+ * @return false if buffered pixels could not be sent or the pixel has not been buffered because a request is pending | true on success
+ */
+bool ArduRPCRequestCoalescer::setPixelColor(uint8_t handler_id, uint16_t n, uint8_t color1, uint8_t color2, uint8_t color3)
+{
+  bool res = true;
+
+  if (this->_kind == RPC_COALESCE_STRIP && this->_handler_id == handler_id &&
+      this->_color[0] == color1 && this->_color[1] == color2 && this->_color[2] == color3 &&
+      n == (uint16_t)(this->_index + this->_width)) {
+    this->_width++;
+  } else {
+    res = this->flush();
+    if (this->_kind != RPC_COALESCE_NONE) {
+      // A request is pending, keep the buffered pixels and refuse the new one
+      return false;
+    }
+  }
+
+  if (this->_kind == RPC_COALESCE_NONE) {
+    this->_kind = RPC_COALESCE_STRIP;
+    this->_handler_id = handler_id;
+    this->_index = n;
+    this->_width = 1;
+    this->_color[0] = color1;
+    this->_color[1] = color2;
+    this->_color[2] = color3;
+    this->_pixels = 0;
+    this->_start_time = RPC_MILLIS();
+  }
+  this->_pixels++;
+
+  if (!this->poll()) {
+    return false;
+  }
+  return res;
+}
+
+/**
+ * Send the buffered pixels.
+ *
+ * Nothing is sent while a request is pending, the pixels are kept.
+ *
+ * @return false if a command failed, returned an error or a request is pending | true on success
+ */
+bool ArduRPCRequestCoalescer::flush()
+{
+  uint8_t kind;
+  uint16_t last_width;
+  bool res;
+
+  if (this->_kind == RPC_COALESCE_NONE) {
+    return true;
+  }
+  if (this->_request->getState() == RPC_REQUEST_STATE_PENDING) {
+    return false;
+  }
+
+  // Clear the buffer first, sending resets the request and calls flush() again
+  kind = this->_kind;
+  this->_kind = RPC_COALESCE_NONE;
+
+  if (kind == RPC_COALESCE_STRIP) {
+    if (this->_width == 1) {
+      res = this->_request->call(
+        this->_handler_id, RPC_COALESCE_CMD_SET_PIXEL_COLOR,
+        this->_index, this->_color[0], this->_color[1], this->_color[2]
+      );
+    } else {
+      res = this->_request->call(
+        this->_handler_id, RPC_COALESCE_CMD_SET_RANGE_COLOR,
+        this->_index, (uint16_t)(this->_index + this->_width - 1),
+        this->_color[0], this->_color[1], this->_color[2]
+      );
+    }
+    return res && this->_request->return_code == RPC_RETURN_SUCCESS;
+  }
+
+  last_width = this->_last_width;
+  if (last_width == this->_width) {
+    return this->sendRect(this->_x, this->_y, this->_width, this->_height);
+  }
+  // The last row is incomplete
+  res = true;
+  if (this->_height > 1) {
+    res = this->sendRect(this->_x, this->_y, this->_width, this->_height - 1);
+  }
+  if (!this->sendRect(this->_x, this->_y + (int16_t)this->_height - 1, last_width, 1)) {
+    res = false;
+  }
+  return res;
+}
+
+/**
+ * Send the buffered pixels if they are older than max_delay or more than
+ * max_pixels have been buffered.
+ *
+ * Call this function in the main loop to limit the time pixels are buffered.
+ *
+ * @return false if a command failed | true on success
+ */
+bool ArduRPCRequestCoalescer::poll()
+{
+  if (this->_kind == RPC_COALESCE_NONE) {
+    return true;
+  }
+  if (this->_pixels >= this->max_pixels ||
+      (this->max_delay > 0 && RPC_MILLIS() - this->_start_time >= this->max_delay)) {
+    return this->flush();
+  }
+  return true;
+}
+
+/**
+ * Send a rectangle of the matrix with the smallest command.
+ *
+ * @param x The x position
+ * @param y The y position
+ * @param width The width
+ * @param height The height
+ * @return false if the command failed or returned an error | true on success
+ */
+bool ArduRPCRequestCoalescer::sendRect(int16_t x, int16_t y, uint16_t width, uint16_t height)
+{
+  bool res;
+
+  if (width == 1 && height == 1) {
+    res = this->_request->call(
+      this->_handler_id, RPC_COALESCE_CMD_DRAW_PIXEL,
+      x, y, this->_color[0], this->_color[1], this->_color[2]
+    );
+  } else if (height == 1) {
+    res = this->_request->call(
+      this->_handler_id, RPC_COALESCE_CMD_DRAW_FAST_HLINE,
+      x, y, (int16_t)width, this->_color[0], this->_color[1], this->_color[2]
+    );
+  } else if (width == 1) {
+    res = this->_request->call(
+      this->_handler_id, RPC_COALESCE_CMD_DRAW_FAST_VLINE,
+      x, y, (int16_t)height, this->_color[0], this->_color[1], this->_color[2]
+    );
+  } else {
+    res = this->_request->call(
+      this->_handler_id, RPC_COALESCE_CMD_FILL_RECT,
+      x, y, (int16_t)width, (int16_t)height, this->_color[0], this->_color[1], this->_color[2]
+    );
+  }
+  return res && this->_request->return_code == RPC_RETURN_SUCCESS;
+}
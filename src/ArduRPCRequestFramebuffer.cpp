@@ -0,0 +1,463 @@
+/**
+ * Arduino Remote Procedure Calls - ArduRPC
+ * Copyright (C) 2013-2016 DinoTools
+ *
+ * This file is part of ArduRPC.
+ *
+ * ArduRPC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * ArduRPC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "ArduRPC.h"
+
+//! matrix_gfx::getColorCount
+#define RPC_FRAMEBUFFER_CMD_GET_COLOR_COUNT 0x01
+//! matrix_gfx::getWidth
+#define RPC_FRAMEBUFFER_CMD_GET_WIDTH 0x02
+//! matrix_gfx::getHeight
+#define RPC_FRAMEBUFFER_CMD_GET_HEIGHT 0x03
+//! matrix_gfx::fillRect
+#define RPC_FRAMEBUFFER_CMD_FILL_RECT 0x25
+//! matrix_gfx::drawImage
+#define RPC_FRAMEBUFFER_CMD_DRAW_IMAGE 0x61
+
+//! Bytes of the header and the parameters of drawImage without the image
+#define RPC_FRAMEBUFFER_IMAGE_HEADER_LENGTH (4 + 9)
+
+/**
+ * The constructor.
+ *
+ * Call begin() to read the size of the matrix before drawing.
+ *
+ * @param request The request used to send the commands
+ * @param handler_id The ID of the matrix handler
+ */
+ArduRPCRequestFramebuffer::ArduRPCRequestFramebuffer(ArduRPCRequest &request, uint8_t handler_id)
+{
+  this->_request = &request;
+  this->_handler_id = handler_id;
+  this->_color_count = 0;
+  this->_width = 0;
+  this->_height = 0;
+  this->_pixels = NULL;
+  this->_dirty_x0 = NULL;
+  this->_dirty_x1 = NULL;
+  this->color_encoding = 2;
+}
+
+/**
+ * The destructor frees the framebuffer.
+ */
+ArduRPCRequestFramebuffer::~ArduRPCRequestFramebuffer()
+{
+  free(this->_pixels);
+  free(this->_dirty_x0);
+  free(this->_dirty_x1);
+}
+
+/**
+ * Read the number of colors and the size of the matrix and allocate the
+ * framebuffer.
+ *
+ * All pixels are set to 0 and marked as dirty, the next flush() clears the
+ * matrix.
+ *
+ * @return false if the size could not be read or the memory could not be allocated | true on success
+ */
+bool ArduRPCRequestFramebuffer::begin()
+{
+  uint8_t color_count;
+  uint16_t width;
+  uint16_t height;
+
+  color_count = this->_request->invoke<uint8_t>(this->_handler_id, RPC_FRAMEBUFFER_CMD_GET_COLOR_COUNT);
+  width = this->_request->invoke<uint16_t>(this->_handler_id, RPC_FRAMEBUFFER_CMD_GET_WIDTH);
+  height = this->_request->invoke<uint16_t>(this->_handler_id, RPC_FRAMEBUFFER_CMD_GET_HEIGHT);
+  if (color_count == 0 || color_count > 3 || width == 0 || height == 0) {
+    return false;
+  }
+
+  free(this->_pixels);
+  free(this->_dirty_x0);
+  free(this->_dirty_x1);
+  this->_width = 0;
+  this->_height = 0;
+  this->_pixels = (uint8_t *)malloc((uint32_t)width * height * color_count);
+  this->_dirty_x0 = (uint16_t *)malloc(sizeof(uint16_t) * height);
+  this->_dirty_x1 = (uint16_t *)malloc(sizeof(uint16_t) * height);
+  if (this->_pixels == NULL || this->_dirty_x0 == NULL || this->_dirty_x1 == NULL) {
+    return false;
+  }
+
+  this->_color_count = color_count;
+  this->_width = width;
+  this->_height = height;
+  memset(this->_pixels, 0, (uint32_t)width * height * color_count);
+  this->invalidate();
+  return true;
+}
+
+/**
+ * Set the color of a pixel.
+ *
+ * The pixel is only marked as dirty if the color changes.
+ *
+ * @param x The x position
+ * @param y The y position
+ * @param color1 First color
+ * @param color2 Second color
+ * @param color3 Third color
+ */
+void ArduRPCRequestFramebuffer::drawPixel(int16_t x, int16_t y, uint8_t color1, uint8_t color2, uint8_t color3)
+{
+  this->fillRect(x, y, 1, 1, color1, color2, color3);
+}
+
+/**
+ * Fill a rectangle with a color.
+ *
+ * The rectangle is clipped to the matrix. Only the pixels changing their
+ * color are marked as dirty.
+ *
+ * @param x The x position
+ * @param y The y position
+ * @param w The width
+ * @param h The height
+ * @param color1 First color
+ * @param color2 Second color
+ * @param color3 Third color
+ */
+void ArduRPCRequestFramebuffer::fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint8_t color1, uint8_t color2, uint8_t color3)
+{
+  uint8_t color[3] = {color1, color2, color3};
+  int32_t x0 = x;
+  int32_t y0 = y;
+  int32_t x1 = (int32_t)x + w - 1;
+  int32_t y1 = (int32_t)y + h - 1;
+  int32_t i;
+  int32_t j;
+  int32_t changed_x0;
+  int32_t changed_x1;
+  uint8_t *p;
+
+  if (x0 < 0) {
+    x0 = 0;
+  }
+  if (y0 < 0) {
+    y0 = 0;
+  }
+  if (x1 >= this->_width) {
+    x1 = (int32_t)this->_width - 1;
+  }
+  if (y1 >= this->_height) {
+    y1 = (int32_t)this->_height - 1;
+  }
+
+  for (j = y0; j <= y1; j++) {
+    changed_x0 = -1;
+    changed_x1 = -1;
+    p = this->getPixel(x0, j);
+    for (i = x0; i <= x1; i++) {
+      if (memcmp(p, color, this->_color_count) != 0) {
+        memcpy(p, color, this->_color_count);
+        if (changed_x0 < 0) {
+          changed_x0 = i;
+        }
+        changed_x1 = i;
+      }
+      p += this->_color_count;
+    }
+    if (changed_x0 >= 0) {
+      this->markDirty(changed_x0, changed_x1, j);
+    }
+  }
+}
+
+/**
+ * Fill the matrix with a color.
+ *
+ * @param color1 First color
+ * @param color2 Second color
+ * @param color3 Third color
+ */
+void ArduRPCRequestFramebuffer::fillScreen(uint8_t color1, uint8_t color2, uint8_t color3)
+{
+  this->fillRect(0, 0, this->_width, this->_height, color1, color2, color3);
+}
+
+/**
+ * Send all dirty pixels to the matrix.
+ *
+ * Dirty rows are merged into one rectangle as long as the unchanged pixels
+ * sent with it cost fewer bytes than another request. See
+ * RPC_FRAMEBUFFER_REQUEST_COST. If a command fails the remaining pixels stay
+ * dirty and are sent by the next flush().
+ *
+ * @return false if a command failed | true on success
+ */
+bool ArduRPCRequestFramebuffer::flush()
+{
+  uint16_t x0;
+  uint16_t x1;
+  uint16_t y;
+  uint16_t y1;
+  uint16_t i;
+  uint16_t next_x0;
+  uint16_t next_x1;
+  uint32_t area;
+  uint32_t row_area;
+  uint32_t merged_area;
+  uint8_t pixel_size;
+
+  pixel_size = this->color_encoding < 2 ? this->color_encoding + 1 : 3;
+  for (y = 0; y < this->_height; y = y1 + 1) {
+    y1 = y;
+    if (this->_dirty_x0[y] >= this->_width) {
+      continue;
+    }
+    x0 = this->_dirty_x0[y];
+    x1 = this->_dirty_x1[y];
+    area = x1 - x0 + 1;
+    while (y1 + 1 < this->_height && this->_dirty_x0[y1 + 1] < this->_width) {
+      next_x0 = x0 < this->_dirty_x0[y1 + 1] ? x0 : this->_dirty_x0[y1 + 1];
+      next_x1 = x1 > this->_dirty_x1[y1 + 1] ? x1 : this->_dirty_x1[y1 + 1];
+      row_area = this->_dirty_x1[y1 + 1] - this->_dirty_x0[y1 + 1] + 1;
+      merged_area = (uint32_t)(next_x1 - next_x0 + 1) * (y1 + 2 - y);
+      if ((merged_area - area - row_area) * pixel_size > RPC_FRAMEBUFFER_REQUEST_COST) {
+        break;
+      }
+      x0 = next_x0;
+      x1 = next_x1;
+      area += row_area;
+      y1++;
+    }
+
+    if (!this->sendRect(x0, y, x1 - x0 + 1, y1 - y + 1)) {
+      return false;
+    }
+    for (i = y; i <= y1; i++) {
+      this->_dirty_x0[i] = this->_width;
+      this->_dirty_x1[i] = 0;
+    }
+  }
+  return true;
+}
+
+/**
+ * Get the number of colors of every pixel.
+ *
+ * @return Number of colors or 0 if begin() has not been called
+ */
+uint8_t ArduRPCRequestFramebuffer::getColorCount()
+{
+  return this->_color_count;
+}
+
+/**
+ * Get the height of the matrix.
+ *
+ * @return The height or 0 if begin() has not been called
+ */
+uint16_t ArduRPCRequestFramebuffer::getHeight()
+{
+  return this->_height;
+}
+
+/**
+ * Get the colors of a pixel.
+ *
+ * Only read the colors, changed colors are not marked as dirty.
+ *
+ * @param x The x position
+ * @param y The y position
+ * @return color_count bytes with the colors or NULL if the pixel is outside of the matrix
+ */
+uint8_t *ArduRPCRequestFramebuffer::getPixel(int16_t x, int16_t y)
+{
+  if (x < 0 || y < 0 || x >= this->_width || y >= this->_height) {
+    return NULL;
+  }
+  return &this->_pixels[((uint32_t)y * this->_width + x) * this->_color_count];
+}
+
+/**
+ * Get the width of the matrix.
+ *
+ * @return The width or 0 if begin() has not been called
+ */
+uint16_t ArduRPCRequestFramebuffer::getWidth()
+{
+  return this->_width;
+}
+
+/**
+ * Mark all pixels as dirty.
+ *
+ * Call it if the content of the matrix is unknown, e.g. after the device has
+ * been restarted.
+ */
+void ArduRPCRequestFramebuffer::invalidate()
+{
+  uint16_t y;
+
+  for (y = 0; y < this->_height; y++) {
+    this->_dirty_x0[y] = 0;
+    this->_dirty_x1[y] = this->_width - 1;
+  }
+}
+
+/**
+ * Check if all pixels of a rectangle have the same color.
+ *
+ * @param x The x position
+ * @param y The y position
+ * @param w The width
+ * @param h The height
+ * @return true if all pixels have the same color | false otherwise
+ */
+bool ArduRPCRequestFramebuffer::isUniform(uint16_t x, uint16_t y, uint16_t w, uint16_t h)
+{
+  uint8_t *color;
+  uint8_t *p;
+  uint16_t i;
+  uint16_t j;
+
+  color = this->getPixel(x, y);
+  for (j = 0; j < h; j++) {
+    p = this->getPixel(x, y + j);
+    for (i = 0; i < w; i++) {
+      if (memcmp(p, color, this->_color_count) != 0) {
+        return false;
+      }
+      p += this->_color_count;
+    }
+  }
+  return true;
+}
+
+/**
+ * Extend the dirty pixels of a row.
+ *
+ * @param x0 The first dirty pixel
+ * @param x1 The last dirty pixel
+ * @param y The row
+ */
+void ArduRPCRequestFramebuffer::markDirty(uint16_t x0, uint16_t x1, uint16_t y)
+{
+  if (x0 < this->_dirty_x0[y]) {
+    this->_dirty_x0[y] = x0;
+  }
+  if (x1 > this->_dirty_x1[y]) {
+    this->_dirty_x1[y] = x1;
+  }
+}
+
+/**
+ * Send the pixels of a rectangle with drawImage.
+ *
+ * The rectangle must fit into one request.
+ *
+ * @param x The x position
+ * @param y The y position
+ * @param w The width
+ * @param h The height
+ * @return false if the command failed | true on success
+ */
+bool ArduRPCRequestFramebuffer::sendImage(uint16_t x, uint16_t y, uint16_t w, uint16_t h)
+{
+  uint8_t color[3] = {0, 0, 0};
+  uint8_t *p;
+  uint16_t i;
+  uint16_t j;
+
+  this->_request->reset();
+  this->_request->writeRequest_int16(x);
+  this->_request->writeRequest_int16(y);
+  this->_request->writeRequest_int16(w);
+  this->_request->writeRequest_int16(h);
+  this->_request->writeRequest_uint8(this->color_encoding);
+  for (j = 0; j < h; j++) {
+    p = this->getPixel(x, y + j);
+    for (i = 0; i < w; i++) {
+      memcpy(color, p, this->_color_count);
+      p += this->_color_count;
+      if (this->color_encoding == 0) {
+        this->_request->writeRequest_uint8((color[0] & 0xc0) | ((color[1] & 0xe0) >> 2) | (color[2] >> 5));
+      } else if (this->color_encoding == 1) {
+        this->_request->writeRequest_uint16(((uint16_t)(color[0] & 0xf8) << 8) | ((uint16_t)(color[1] & 0xfc) << 3) | (color[2] >> 3));
+      } else {
+        this->_request->writeRequest_uint8(color[0]);
+        this->_request->writeRequest_uint8(color[1]);
+        this->_request->writeRequest_uint8(color[2]);
+      }
+    }
+  }
+  return this->_request->call(this->_handler_id, RPC_FRAMEBUFFER_CMD_DRAW_IMAGE) &&
+         this->_request->return_code == RPC_RETURN_SUCCESS;
+}
+
+/**
+ * Send the pixels of a rectangle.
+ *
+ * A rectangle with one color is sent with fillRect. Other rectangles are
+ * split into parts fitting into one request and sent with drawImage.
+ *
+ * @param x The x position
+ * @param y The y position
+ * @param w The width
+ * @param h The height
+ * @return false if a command failed | true on success
+ */
+bool ArduRPCRequestFramebuffer::sendRect(uint16_t x, uint16_t y, uint16_t w, uint16_t h)
+{
+  uint8_t color[3] = {0, 0, 0};
+  uint16_t max_pixels;
+  uint16_t rows;
+  uint16_t i;
+  uint16_t j;
+
+  if (this->isUniform(x, y, w, h)) {
+    memcpy(color, this->getPixel(x, y), this->_color_count);
+    return this->_request->call(
+      this->_handler_id, RPC_FRAMEBUFFER_CMD_FILL_RECT,
+      (int16_t)x, (int16_t)y, (int16_t)w, (int16_t)h, color[0], color[1], color[2]
+    ) && this->_request->return_code == RPC_RETURN_SUCCESS;
+  }
+
+  max_pixels = (RPC_MAX_DATA_LENGTH - 1 - RPC_FRAMEBUFFER_IMAGE_HEADER_LENGTH) /
+               (this->color_encoding < 2 ? this->color_encoding + 1 : 3);
+  if ((uint32_t)w * h <= max_pixels) {
+    return this->sendImage(x, y, w, h);
+  }
+
+  if (w > max_pixels) {
+    // Split every row
+    for (j = 0; j < h; j++) {
+      for (i = 0; i < w; i += max_pixels) {
+        if (!this->sendRect(x + i, y + j, w - i < max_pixels ? w - i : max_pixels, 1)) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  rows = max_pixels / w;
+  for (j = 0; j < h; j += rows) {
+    if (!this->sendRect(x, y + j, w, h - j < rows ? h - j : rows)) {
+      return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,148 @@
+/**
+ * Arduino Remote Procedure Calls - ArduRPC
+ * Copyright (C) 2013-2016 DinoTools
+ *
+ * This file is part of ArduRPC.
+ *
+ * ArduRPC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * ArduRPC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ArduRPC.h"
+
+/**
+ * The constructor.
+ *
+ * @param max_request_count: Maximum number of requests
+ *
+ */
+ArduRPCRequestMultiplexer::ArduRPCRequestMultiplexer(uint8_t max_request_count)
+{
+  this->_requests = (ArduRPCRequest **)malloc(sizeof(ArduRPCRequest *) * max_request_count);
+  this->_request_count = 0;
+  this->_max_request_count = max_request_count;
+}
+
+/**
+ * Add a request.
+ *
+ * The connection of the request must be set up before.
+ *
+ * @param request: The request
+ * @return true on success | false if the list is full
+ */
+bool ArduRPCRequestMultiplexer::add(ArduRPCRequest &request)
+{
+  uint8_t i;
+
+  for(i = 0; i < this->_request_count; i++) {
+    if(this->_requests[i] == &request) {
+      return true;
+    }
+  }
+
+  if(this->_request_count >= this->_max_request_count) {
+    return false;
+  }
+  this->_requests[this->_request_count++] = &request;
+  return true;
+}
+
+/**
+ * Get a request by its position in the list.
+ *
+ * @param i: Position in the list
+ * @return The request or NULL
+ */
+ArduRPCRequest *ArduRPCRequestMultiplexer::getRequest(uint8_t i)
+{
+  if(i >= this->_request_count) {
+    return NULL;
+  }
+  return this->_requests[i];
+}
+
+/**
+ * Get the number of requests in the list.
+ *
+ * @return Number of requests
+ */
+uint8_t ArduRPCRequestMultiplexer::getRequestCount()
+{
+  return this->_request_count;
+}
+
+/**
+ * Process the received data of all pending requests.
+ *
+ * This function does not block. Requests exceeding the timeout of their
+ * connection change to RPC_REQUEST_STATE_ERROR.
+ *
+ * @return Number of requests still pending
+ */
+uint8_t ArduRPCRequestMultiplexer::poll()
+{
+  uint8_t i;
+  uint8_t pending = 0;
+
+  for(i = 0; i < this->_request_count; i++) {
+    if(this->_requests[i]->poll() == RPC_REQUEST_STATE_PENDING) {
+      pending++;
+    }
+  }
+  return pending;
+}
+
+/**
+ * Remove a request.
+ *
+ * @param request: The request
+ * @return true on success | false if the request was not in the list
+ */
+bool ArduRPCRequestMultiplexer::remove(ArduRPCRequest &request)
+{
+  uint8_t i;
+
+  for(i = 0; i < this->_request_count; i++) {
+    if(this->_requests[i] == &request) {
+      this->_request_count--;
+      this->_requests[i] = this->_requests[this->_request_count];
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Wait until no request is pending.
+ *
+ * The connections are polled in turn with RPC_DELAY(1) in between, so the
+ * idle callback keeps running and a host does not spin at full load.
+ *
+ * @return true if all requests have been successful
+ */
+bool ArduRPCRequestMultiplexer::wait()
+{
+  uint8_t i;
+
+  while(this->poll() > 0) {
+    RPC_DELAY(1);
+  }
+
+  for(i = 0; i < this->_request_count; i++) {
+    if(this->_requests[i]->getState() != RPC_REQUEST_STATE_DONE) {
+      return false;
+    }
+  }
+  return true;
+}
@@ -34,6 +34,13 @@ ArduRPCRequest_Serial::ArduRPCRequest_Serial(ArduRPCRequest &rpc, Stream &serial
   this->_serial = &serial;
   this->_state = 0;
   this->timeout = 5000;
+  this->priority = false;
+  this->_priority_sent = false;
+  this->_time_start = 0;
+  this->_waiting = false;
+  this->_streamed = false;
+  this->_code_pending = false;
+  this->_notification_callback = NULL;
 }
 
 void ArduRPCRequest_Serial::reset()
@@ -44,6 +51,11 @@ void ArduRPCRequest_Serial::reset()
 
 
 /**
+ * Send a request encoded as hex string.
+ *
+ * The request is sent as priority request ('*') if priority is set.
+ *
+ * @param request: The request data
  */
 void ArduRPCRequest_Serial::send(rpc_data_t request)
 {
@@ -56,7 +68,13 @@ void ArduRPCRequest_Serial::send(rpc_data_t request)
     return;
   }
 
-  this->_serial->print(":");
+  this->_time_start = RPC_MILLIS();
+  this->_waiting = true;
+  this->_streamed = false;
+  this->_code_pending = false;
+  this->_priority_sent = this->priority;
+
+  this->_serial->print(this->priority ? "*" : ":");
   data = request.data;
   for (i = 0; i < len; i++) {
     if (data[0] < 0x10)
@@ -95,47 +113,166 @@ bool ArduRPCRequest_Serial::processDataHex(uint8_t c)
     this->_tmp_data_part = 1;
   } else {
     this->_tmp_data |= c;
-    this->rpc->writeResult(this->_tmp_data);
+    if(this->_state == 2) {
+      if(this->_notification_length < RPC_MAX_NOTIFICATION_LENGTH) {
+        this->_notification[this->_notification_length++] = this->_tmp_data;
+      }
+    } else if(this->_code_pending) {
+      this->rpc->setReturnCode(this->_tmp_data);
+      this->_code_pending = false;
+    } else {
+      this->rpc->writeResult(this->_tmp_data);
+    }
     this->_tmp_data_part = 0;
   }
   return false;
 }
 
 /**
+ * Process all available data without blocking.
+ *
+ * Results sent in parts (';') are collected until the last part with the
+ * return code (':') has been received. If a part callback has been set with
+ * ArduRPCRequest::setResultPartCallback() every part is passed to it.
+ *
+ * Only results of the lane the request has been sent on are used. Priority
+ * results ('*') are skipped while a normal request is pending and normal
+ * results (':' and ';') while a priority request is pending.
+ *
+ * Notifications are passed to the notification callback. Call this function
+ * periodically to receive notifications even if no request is pending.
+ *
+ * @return The state. See RPC_REQUEST_STATE_*
  */
-bool ArduRPCRequest_Serial::waitResult()
+uint8_t ArduRPCRequest_Serial::poll()
 {
   uint8_t c;
-  bool result;
-  unsigned long time_start, time_current;
-  time_start = millis();
-  while(1) {
-    time_current = millis();
-    if(time_current - time_start > this->timeout) {
-      this->error = 1;
-      return false;
+
+  while(this->_serial->available() > 0) {
+    c = this->_serial->read();
+
+    if (this->_state == 1) {
+      if (this->processDataHex(c)) {
+        this->_state = 0;
+        this->_waiting = false;
+        this->_streamed = false;
+        return RPC_REQUEST_STATE_DONE;
+      }
     }
-    if (this->_serial->available() == 0) {
-      // Some boards crash without a delay()
-      delay(100);
+
+    if (this->_state == 3) {
+      if (this->processDataHex(c)) {
+        this->_state = 0;
+        // Every part restarts the timeout
+        this->_time_start = RPC_MILLIS();
+        this->rpc->flushResult();
+      }
       continue;
     }
-  
-    c = this->_serial->read();
-  
-    if (this->_state == 1) {
-      result = this->processDataHex(c);
-      if (result) {
+
+    if (this->_state == 4) {
+      // Skip the result of the other lane
+      if (c == '\n') {
+        this->_state = 0;
+      }
+      continue;
+    }
+
+    if (this->_state == 2) {
+      if (this->processDataHex(c)) {
         this->_state = 0;
-        return true;
+        if (this->_notification_callback != NULL && this->_notification_length > 0) {
+          this->_notification_callback(
+            this->_notification[0],
+            &this->_notification[1],
+            this->_notification_length - 1,
+            this->_notification_arg
+          );
+        }
       }
+      continue;
+    }
+
+    if (this->_state == 0 && (c == ':' || c == ';' || c == '*') && (c == '*') != this->_priority_sent) {
+      this->_state = 4;
+      continue;
     }
-  
-    if (this->_state == 0 && c == ':') {
+
+    if (this->_state == 0 && (c == ':' || c == '*')) {
       this->_state = 1;
-      this->rpc->reset();
+      if (this->_streamed) {
+        // Keep the received parts, the first byte is the return code
+        this->_code_pending = true;
+      } else {
+        this->rpc->reset();
+      }
+      this->_tmp_data_part = 0;
+    }
+
+    if (this->_state == 0 && c == ';') {
+      this->_state = 3;
+      if (!this->_streamed) {
+        this->rpc->reset();
+        // Placeholder for the return code
+        this->rpc->writeResult(0x00);
+        this->_streamed = true;
+      }
+      this->_tmp_data_part = 0;
+    }
+
+    if (this->_state == 0 && c == '!') {
+      this->_state = 2;
+      this->_notification_length = 0;
       this->_tmp_data_part = 0;
     }
   }
+
+  if (!this->_waiting) {
+    return RPC_REQUEST_STATE_IDLE;
+  }
+
+  if(RPC_MILLIS() - this->_time_start > this->timeout) {
+    this->error = 1;
+    this->_state = 0;
+    this->_waiting = false;
+    return RPC_REQUEST_STATE_ERROR;
+  }
+  return RPC_REQUEST_STATE_PENDING;
+}
+
+/**
+ * Set the function to call if a notification has been received.
+ *
+ * The callback gets the ID of the subscription and the result of the
+ * subscribed command starting with the return code.
+ *
+ * @param callback: The function to call
+ * @param arg: Argument passed to the callback
+ */
+void ArduRPCRequest_Serial::setNotificationCallback(rpc_notification_callback_t callback, void *arg)
+{
+  this->_notification_callback = callback;
+  this->_notification_arg = arg;
 }
 
+/**
+ * Wait until the result has been received or the request has timed out.
+ *
+ * @return true if the result has been received
+ */
+bool ArduRPCRequest_Serial::waitResult()
+{
+  uint8_t res;
+
+  while(1) {
+    res = this->poll();
+    if (res == RPC_REQUEST_STATE_DONE) {
+      return true;
+    }
+    if (res != RPC_REQUEST_STATE_PENDING) {
+      return false;
+    }
+    // Some boards crash without a delay()
+    RPC_DELAY(100);
+  }
+}
@@ -0,0 +1,255 @@
+/**
+ * Arduino Remote Procedure Calls - ArduRPC
+ * Copyright (C) 2013-2016 DinoTools
+ *
+ * This file is part of ArduRPC.
+ *
+ * ArduRPC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * ArduRPC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ArduRPC.h"
+
+/**
+ * The constructor.
+ *
+ * @param data The typed values, e.g. the result without the return code
+ * @param length Number of bytes
+ */
+ArduRPCResultParser::ArduRPCResultParser(uint8_t *data, uint8_t length)
+{
+  this->_data = data;
+  this->_length = length;
+  this->_pos = 0;
+  this->_error = 0;
+}
+
+/**
+ * Parse the next value.
+ *
+ * The type and the length of the value are checked once. The data is not
+ * copied. Use a new parser on value->data to walk the values of an
+ * RPC_VARRAY.
+ *
+ * @param value The value found
+ * @return true if a value has been found | false at the end of the data or if the data is invalid
+ */
+bool ArduRPCResultParser::next(rpc_value_t *value)
+{
+  uint8_t *d;
+  uint8_t remaining;
+  uint8_t header;
+  uint16_t length;
+  uint8_t size;
+  uint8_t i;
+
+  if (this->_error > 0 || this->_pos >= this->_length) {
+    return false;
+  }
+  d = &this->_data[this->_pos];
+  remaining = this->_length - this->_pos;
+
+  value->type = d[0];
+  value->columns = 0;
+  value->count = 0;
+  value->types = NULL;
+
+  size = rpc_type_size(d[0]);
+  if (size > 0) {
+    header = 1;
+    length = size;
+  } else {
+    switch (d[0]) {
+      case RPC_VARUINT:
+      case RPC_VARINT:
+        header = 1;
+        if (remaining < 2) {
+          this->_error = 0x02;
+          return false;
+        }
+        for (length = 1; length < 5 && length < remaining - 1 && (d[length] & 0x80); length++) {
+        }
+        if (d[length] & 0x80) {
+          this->_error = 0x02;
+          return false;
+        }
+        break;
+      case RPC_STRING:
+        header = 2;
+        if (remaining < header) {
+          this->_error = 0x02;
+          return false;
+        }
+        value->count = d[1];
+        length = d[1];
+        break;
+      case RPC_ARRAY:
+        header = 3;
+        if (remaining < header || rpc_type_size(d[1]) == 0) {
+          this->_error = 0x02;
+          return false;
+        }
+        value->columns = 1;
+        value->types = &d[1];
+        value->count = d[2];
+        length = (uint16_t)d[2] * rpc_type_size(d[1]);
+        break;
+      case RPC_MCARRAY:
+        if (remaining < 2 || remaining < 3 + d[1]) {
+          this->_error = 0x02;
+          return false;
+        }
+        header = 3 + d[1];
+        length = 0;
+        for (i = 0; i < d[1]; i++) {
+          size = rpc_type_size(d[2 + i]);
+          if (size == 0) {
+            this->_error = 0x02;
+            return false;
+          }
+          length += size;
+        }
+        value->columns = d[1];
+        value->types = &d[2];
+        value->count = d[2 + d[1]];
+        length *= d[2 + d[1]];
+        break;
+      case RPC_VARRAY:
+        header = 2;
+        if (remaining < header) {
+          this->_error = 0x02;
+          return false;
+        }
+        length = d[1];
+        break;
+      default:
+        this->_error = 0x02;
+        return false;
+    }
+  }
+
+  if (remaining < header + length) {
+    this->_error = 0x02;
+    return false;
+  }
+  value->data = &d[header];
+  value->length = length;
+  this->_pos += header + length;
+  return true;
+}
+
+/**
+ * Get the error.
+ *
+ * @return 0 = no error | 0x02 = the data is invalid
+ */
+uint8_t ArduRPCResultParser::getError()
+{
+  return this->_error;
+}
+
+/**
+ * Get the position of the next value.
+ *
+ * @return Number of bytes parsed
+ */
+uint8_t ArduRPCResultParser::getPosition()
+{
+  return this->_pos;
+}
+
+/**
+ * Decode a variable length unsigned integer (LEB128).
+ *
+ * @param data The data
+ * @param length Number of bytes
+ * @return The value
+ */
+static uint32_t rpc_decode_varuint(uint8_t *data, uint8_t length)
+{
+  uint32_t res = 0;
+  uint8_t i;
+
+  for (i = 0; i < length; i++) {
+    res |= (uint32_t)(data[i] & 0x7f) << (7 * i);
+  }
+  return res;
+}
+
+/**
+ * Convert a number to a float.
+ *
+ * @param value The value
+ * @return The number or 0 if the value is not a number
+ */
+float ArduRPCResultParser::getFloat(rpc_value_t *value)
+{
+  switch (value->type) {
+    case RPC_FLOAT:
+      return rpc_read_float(value->data);
+    case RPC_UINT32:
+    case RPC_VARUINT:
+      return getUint32(value);
+  }
+  return getInt32(value);
+}
+
+/**
+ * Convert a number to an int32_t.
+ *
+ * @param value The value
+ * @return The number or 0 if the value is not a number
+ */
+int32_t ArduRPCResultParser::getInt32(rpc_value_t *value)
+{
+  switch (value->type) {
+    case RPC_INT8:
+      return rpc_read_int8(value->data);
+    case RPC_INT16:
+      return rpc_read_int16(value->data);
+    case RPC_INT32:
+      return rpc_read_int32(value->data);
+    case RPC_VARINT:
+      return rpc_zigzag_decode(rpc_decode_varuint(value->data, value->length));
+    case RPC_FLOAT:
+      return rpc_read_float(value->data);
+  }
+  return getUint32(value);
+}
+
+/**
+ * Convert a number to an uint32_t.
+ *
+ * @param value The value
+ * @return The number or 0 if the value is not a number
+ */
+uint32_t ArduRPCResultParser::getUint32(rpc_value_t *value)
+{
+  switch (value->type) {
+    case RPC_UINT8:
+      return rpc_read_uint8(value->data);
+    case RPC_UINT16:
+      return rpc_read_uint16(value->data);
+    case RPC_UINT32:
+      return rpc_read_uint32(value->data);
+    case RPC_VARUINT:
+      return rpc_decode_varuint(value->data, value->length);
+    case RPC_INT8:
+    case RPC_INT16:
+    case RPC_INT32:
+    case RPC_VARINT:
+    case RPC_FLOAT:
+      return getInt32(value);
+  }
+  return 0;
+}
@@ -0,0 +1,330 @@
+/**
+ * Arduino Remote Procedure Calls - ArduRPC
+ * Copyright (C) 2013-2016 DinoTools
+ *
+ * This file is part of ArduRPC.
+ *
+ * ArduRPC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * ArduRPC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ArduRPC.h"
+
+#if RPC_NETWORK > 0
+
+/**
+ * The constructor.
+ *
+ * @param rpc: Specify the rpc handler to use
+ * @param max_connections: Maximum number of connections handled at the same time
+ *
+ */
+ArduRPC_Network::ArduRPC_Network(ArduRPC &rpc, uint8_t max_connections)
+{
+  uint8_t i;
+
+  this->_rpc = &rpc;
+  this->_max_connections = max_connections;
+  this->_connections = (rpc_network_connection_t *)malloc(sizeof(rpc_network_connection_t) * max_connections);
+  for(i = 0; i < max_connections; i++) {
+    this->_connections[i].client = NULL;
+    this->_connections[i].context_id = 0xff;
+  }
+  for(i = 0; i < RPC_NETWORK_CONTEXT_COUNT; i++) {
+    this->_contexts[i] = new ArduRPCContext();
+    this->_contexts[i]->setResultWriter(this);
+    this->_contexts[i]->setPendingAllowed(true);
+  }
+  this->_contexts_used = 0;
+}
+
+/**
+ * Attach a new connection.
+ *
+ * The client object must be available until the connection has been closed.
+ * Closed connections are detected and removed by readData().
+ *
+ * @param client: The connection
+ * @return true on success | false if all slots are in use
+ */
+bool ArduRPC_Network::attach(Client &client)
+{
+  uint8_t i;
+  rpc_network_connection_t *connection;
+
+  for(i = 0; i < this->_max_connections; i++) {
+    connection = &this->_connections[i];
+    if(connection->client == &client) {
+      return true;
+    }
+  }
+
+  for(i = 0; i < this->_max_connections; i++) {
+    connection = &this->_connections[i];
+    if(connection->client == NULL) {
+      connection->client = &client;
+      connection->context_id = 0xff;
+      connection->state = 0;
+      connection->stash_length = 0;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Get the number of attached connections.
+ *
+ * @return Number of connections
+ */
+uint8_t ArduRPC_Network::getConnectionCount()
+{
+  uint8_t i;
+  uint8_t count = 0;
+
+  for(i = 0; i < this->_max_connections; i++) {
+    if(this->_connections[i].client != NULL) {
+      count++;
+    }
+  }
+  return count;
+}
+
+/**
+ * Read and process data from one connection.
+ *
+ * The data is read in chunks of up to RPC_NETWORK_CHUNK_SIZE bytes. A
+ * connection without a request in progress is only read if a context is free.
+ *
+ * If a handler has not completed a request no data is read from the
+ * connection. The rest of the chunk is kept and processed after the result
+ * has been sent.
+ *
+ * @param connection: The connection to process
+ */
+void ArduRPC_Network::processConnection(rpc_network_connection_t *connection)
+{
+  uint8_t buf[RPC_NETWORK_CHUNK_SIZE];
+  uint8_t c;
+  uint8_t i;
+  int len;
+  ArduRPCContext *ctx;
+
+  if(connection->state == 2) {
+    ctx = this->_contexts[connection->context_id];
+    if(ctx->isPending()) {
+      return;
+    }
+    this->processResultHex(connection->client, ctx);
+    this->releaseConnection(connection);
+  }
+
+  if(connection->context_id == 0xff && this->_contexts_used == (1 << RPC_NETWORK_CONTEXT_COUNT) - 1) {
+    return;
+  }
+
+  if(connection->stash_length > 0) {
+    len = connection->stash_length;
+    memcpy(buf, connection->stash, len);
+    connection->stash_length = 0;
+  } else if(connection->client->available() < 1) {
+    return;
+  } else {
+    len = connection->client->read(buf, RPC_NETWORK_CHUNK_SIZE);
+  }
+
+  for(i = 0; (int)i < len; i++) {
+    c = buf[i];
+
+    if(connection->state == 1) {
+      ctx = this->_contexts[connection->context_id];
+      if(c == '\r') {
+        continue;
+      }
+
+      if(c == '\n') {
+        this->_rpc->process(ctx);
+        if(ctx->isPending()) {
+          // Keep the remaining data until the request has been completed
+          connection->state = 2;
+          connection->stash_length = len - i - 1;
+          memcpy(connection->stash, &buf[i + 1], connection->stash_length);
+          return;
+        }
+        this->processResultHex(connection->client, ctx);
+        this->releaseConnection(connection);
+        continue;
+      }
+
+      c = rpc_hex_decode(c);
+      if(connection->tmp_data_part == 0) {
+        connection->tmp_data = c << 4;
+        connection->tmp_data_part = 1;
+      } else {
+        ctx->writeData(connection->tmp_data | c);
+        connection->tmp_data_part = 0;
+      }
+      continue;
+    }
+
+    if(c == ':') {
+      for(connection->context_id = 0; connection->context_id < RPC_NETWORK_CONTEXT_COUNT; connection->context_id++) {
+        if(!(this->_contexts_used & (1 << connection->context_id))) {
+          break;
+        }
+      }
+      // A context is always free because all others are released while processing the chunk
+      this->_contexts_used |= (1 << connection->context_id);
+      this->_contexts[connection->context_id]->reset();
+      connection->state = 1;
+      connection->tmp_data_part = 0;
+    }
+  }
+}
+
+/**
+ * Encode the result as hex string and write it to the connection.
+ *
+ * @param client: The connection
+ * @param ctx: The context with the result
+ */
+void ArduRPC_Network::processResultHex(Client *client, ArduRPCContext *ctx)
+{
+  uint8_t len;
+
+  len = ctx->getResultLength();
+  if(len == 0) {
+    return;
+  }
+
+  this->writeFrameHex(client, ':', ctx->getResultData(), len);
+}
+
+/**
+ * Encode data as hex string and write it to the connection.
+ *
+ * The data is written in chunks of up to RPC_NETWORK_CHUNK_SIZE bytes.
+ *
+ * @param client: The connection
+ * @param start: The first character of the frame
+ * @param data: The data
+ * @param length: Number of bytes
+ */
+void ArduRPC_Network::writeFrameHex(Client *client, char start, uint8_t *data, uint8_t length)
+{
+  char buf[RPC_NETWORK_CHUNK_SIZE * 2];
+  uint8_t i;
+  uint8_t pos;
+
+  buf[0] = start;
+  pos = 1;
+  for(i = 0; i < length; i++) {
+    if(pos + 2 > (uint8_t)sizeof(buf)) {
+      client->write((uint8_t *)buf, pos);
+      pos = 0;
+    }
+    buf[pos++] = rpc_hex_encode(data[i] >> 4);
+    buf[pos++] = rpc_hex_encode(data[i]);
+  }
+  if(pos + 1 > (uint8_t)sizeof(buf)) {
+    client->write((uint8_t *)buf, pos);
+    pos = 0;
+  }
+  buf[pos++] = '\n';
+  client->write((uint8_t *)buf, pos);
+}
+
+/**
+ * Write a part of a large result to the connection of the context.
+ *
+ * A part starts with a semicolon (';'). The last part of the result is sent
+ * with the return code by processResultHex().
+ *
+ * @param ctx: The context of the request
+ * @param data: The result data
+ * @param length: Number of bytes
+ */
+void ArduRPC_Network::writeResultChunk(ArduRPCContext *ctx, uint8_t *data, uint8_t length)
+{
+  uint8_t i;
+  rpc_network_connection_t *connection;
+
+  for(i = 0; i < this->_max_connections; i++) {
+    connection = &this->_connections[i];
+    if(connection->client != NULL && connection->state != 3 && connection->context_id != 0xff &&
+       this->_contexts[connection->context_id] == ctx) {
+      this->writeFrameHex(connection->client, ';', data, length);
+      return;
+    }
+  }
+}
+
+/**
+ * Read and process data from all connections.
+ *
+ * Call this function in the main loop. Closed connections are removed. The
+ * slot and context of a connection closed while a request is pending are kept
+ * until the handler has completed the request.
+ *
+ * @see ArduRPC::complete()
+ */
+void ArduRPC_Network::readData()
+{
+  uint8_t i;
+  rpc_network_connection_t *connection;
+
+  for(i = 0; i < this->_max_connections; i++) {
+    connection = &this->_connections[i];
+    if(connection->client == NULL) {
+      continue;
+    }
+
+    if(connection->state == 3) {
+      if(!this->_contexts[connection->context_id]->isPending()) {
+        this->releaseConnection(connection);
+        connection->client = NULL;
+      }
+      continue;
+    }
+
+    if(!connection->client->connected() && connection->client->available() < 1) {
+      connection->client->stop();
+      if(connection->state == 2 && this->_contexts[connection->context_id]->isPending()) {
+        // The handler still uses the context
+        connection->state = 3;
+        continue;
+      }
+      this->releaseConnection(connection);
+      connection->client = NULL;
+      continue;
+    }
+
+    this->processConnection(connection);
+  }
+}
+
+/**
+ * Release the context used by a connection and reset the processing state.
+ *
+ * @param connection: The connection
+ */
+void ArduRPC_Network::releaseConnection(rpc_network_connection_t *connection)
+{
+  if(connection->context_id != 0xff) {
+    this->_contexts_used &= ~(1 << connection->context_id);
+    connection->context_id = 0xff;
+  }
+  connection->state = 0;
+}
+
+#endif
@@ -32,12 +32,22 @@ ArduRPC_Serial::ArduRPC_Serial(Stream &serial, ArduRPC &rpc)
   this->_serial = &serial;
   this->_rpc = &rpc;
   this->_state = 0;
+  this->_result_pos = 0;
+#if RPC_SERIAL_PRIORITY_LENGTH > 0
+#if RPC_SHARED_BUFFERS == 1
+  this->_priority_context = new ArduRPCContext(this->_priority_data, this->_priority_data, RPC_SERIAL_PRIORITY_LENGTH, RPC_SERIAL_PRIORITY_LENGTH);
+#else
+  this->_priority_context = new ArduRPCContext(this->_priority_data, this->_priority_result, RPC_SERIAL_PRIORITY_LENGTH, RPC_SERIAL_PRIORITY_LENGTH);
+#endif
+  this->_priority_receiving = false;
+#endif
 }
 
 /**
  * Replace the main loop.
  *
- * Can be used if the main loop() only calls readData().
+ * Can be used if the main loop() only calls readData(). Use poll() if the
+ * main loop has other work to do.
  *
  * This function will never return.
  */
@@ -48,88 +58,378 @@ void ArduRPC_Serial::loop()
   }
 }
 
+/**
+ * Do a limited amount of work and return.
+ *
+ * Read the received data, process at most one complete request and write
+ * the result until the time budget has been used. The remaining part of the
+ * result is written by the next call. Notifications and parts of large
+ * results are always written at once.
+ *
+ * A request waiting for ArduRPC::complete() counts as pending work, so the
+ * sketch must not sleep while this function returns true.
+ *
+ * Priority requests are also processed while a request is pending or its
+ * result waits to be written. They are not processed while a line of the
+ * result has been partly written.
+ *
+ * @param budget_us: The time to spend in microseconds
+ * @param time_used: Set to the time spent in microseconds if not NULL
+ * @return true if more work is pending | false if idle
+ */
+bool ArduRPC_Serial::poll(uint32_t budget_us, uint32_t *time_used)
+{
+  uint32_t start = RPC_MICROS();
+  bool busy;
+  int c;
+
+  if (this->_state == 2 && !this->_rpc->getContext()->isPending()) {
+    this->finishRequest();
+  }
+  if (this->_state == 3) {
+    this->processResultHex(start, budget_us);
+  }
+  // A priority result must not be written inside of a partly written result
+  if (this->_state == 2 || (this->_state == 3 && this->_result_pos == 0)) {
+    this->readPriority();
+  }
+
+  while (this->_state < 2 && RPC_MICROS() - start < budget_us) {
+    if (this->_serial->available() < 1) {
+      // Only use the context if no request is received at the moment
+      if (this->_state == 0) {
+        this->processSubscriptions();
+      }
+      break;
+    }
+
+    c = this->_serial->read();
+    if (this->receivePriority(c)) {
+      continue;
+    }
+
+    if (this->_state == 1 && this->receiveHex(c, this->_rpc->getContext(), &this->_tmp_data, &this->_tmp_data_part)) {
+      // At most one request per call
+      this->processRequest();
+      this->processResultHex(start, budget_us);
+      break;
+    }
+
+    if (this->_state == 0 && c == ':') {
+      this->startRequest();
+    }
+  }
+
+  busy = this->_state == 2 || this->_state == 3 || this->_serial->available() > 0;
+  if (time_used != NULL) {
+    *time_used = RPC_MICROS() - start;
+  }
+  return busy;
+}
+
 /**
  * Process serial data encoded in hex format.
  *
+ * The result of a complete request is written at once.
+ *
  * @param c: Character to process
  */
 void ArduRPC_Serial::processDataHex(uint8_t c)
+{
+  if (this->receiveHex(c, this->_rpc->getContext(), &this->_tmp_data, &this->_tmp_data_part)) {
+    this->processRequest();
+    this->processResultHex(RPC_MICROS(), RPC_SERIAL_NO_LIMIT);
+  }
+}
+
+/**
+ * Decode a character of a request encoded in hex format.
+ *
+ * @param c: Character to process
+ * @param ctx: The context to write the request to
+ * @param tmp_data: The upper four bits of the current byte
+ * @param tmp_data_part: The part of the current byte
+ * @return true if the request is complete | false if more data is required
+ */
+bool ArduRPC_Serial::receiveHex(uint8_t c, ArduRPCContext *ctx, uint8_t *tmp_data, uint8_t *tmp_data_part)
 {
   if(c == '\r') {
-    return;
+    return false;
   }
 
   if(c == '\n') {
-    this->_rpc->process();
-    this->processResultHex();
-    this->_state = 0;
-    return;
+    return true;
   }
 
-  if(c >= 97) {
-    c -= 87;
-  } else if(c >= 65) {
-    c -= 55;
+  c = rpc_hex_decode(c);
+  if(*tmp_data_part == 0) {
+    *tmp_data = c << 4;
+    *tmp_data_part = 1;
   } else {
-    c -= 48;
+    ctx->writeData(*tmp_data | c);
+    *tmp_data_part = 0;
   }
+  return false;
+}
 
-  if(this->_tmp_data_part == 0) {
-    c = c << 4;
-    this->_tmp_data = c;
-    this->_tmp_data_part = 1;
-  } else {
-    this->_tmp_data |= c;
-    this->_rpc->writeData(this->_tmp_data);
-    this->_tmp_data_part = 0;
+/**
+ * Pass a character to the priority lane.
+ *
+ * A priority request starts with an asterisk ('*') and may be sent inside of
+ * a normal request. It is processed as soon as it is complete and its result
+ * is sent at once, starting with an asterisk. Pending priority requests are
+ * not supported.
+ *
+ * @param c: Character to process
+ * @return true if the character belongs to a priority request | false if not
+ */
+bool ArduRPC_Serial::receivePriority(uint8_t c)
+{
+#if RPC_SERIAL_PRIORITY_LENGTH > 0
+  ArduRPCContext *ctx = this->_priority_context;
+
+  if (c == '*') {
+    this->_priority_receiving = true;
+    this->_priority_tmp_data_part = 0;
+    ctx->reset();
+    return true;
+  }
+
+  if (!this->_priority_receiving) {
+    return false;
   }
+
+  if (this->receiveHex(c, ctx, &this->_priority_tmp_data, &this->_priority_tmp_data_part)) {
+    this->_priority_receiving = false;
+    this->_rpc->process(ctx);
+    if (ctx->getResultLength() > 0) {
+      this->_serial->print("*");
+      this->writeHex(ctx->getResultData(), ctx->getResultLength());
+      this->_serial->print('\n');
+    }
+  }
+  return true;
+#else
+  return false;
+#endif
 }
 
 /**
- * Process the result and write it to the serial port using the HEX encoding.
+ * Read and process priority requests while the normal lane does not read
+ * any data.
  */
-void ArduRPC_Serial::processResultHex()
+void ArduRPC_Serial::readPriority()
 {
-    uint8_t i;
-    uint8_t len;
-    uint8_t *data;
+#if RPC_SERIAL_PRIORITY_LENGTH > 0
+  int c;
 
-    len = this->_rpc->getResultLength();
-    if (len == 0) {
+  while (this->_serial->available() > 0) {
+    c = this->_serial->peek();
+    if (c != '*' && !this->_priority_receiving) {
       return;
     }
+    this->receivePriority(this->_serial->read());
+  }
+#endif
+}
 
-    this->_serial->print(":");
-    data = this->_rpc->getResultData();
-    for (i = 0; i < len; i++) {
-      if (data[0] < 0x10)
-        this->_serial->print('0');
-      this->_serial->print(data[0], HEX);
-      data++;
+/**
+ * Prepare the context to receive a new request.
+ */
+void ArduRPC_Serial::startRequest()
+{
+  this->_state = 1;
+  this->_rpc->reset();
+  this->_tmp_data_part = 0;
+}
+
+/**
+ * Process the received request.
+ */
+void ArduRPC_Serial::processRequest()
+{
+  ArduRPCContext *ctx = this->_rpc->getContext();
+
+  ctx->setResultWriter(this);
+  ctx->setPendingAllowed(true);
+  this->_rpc->process();
+  if (ctx->isPending()) {
+    // Wait for the handler to complete the request
+    this->_state = 2;
+    return;
+  }
+  this->finishRequest();
+}
+
+/**
+ * Start to send the result of the processed request.
+ */
+void ArduRPC_Serial::finishRequest()
+{
+  ArduRPCContext *ctx = this->_rpc->getContext();
+
+  ctx->setPendingAllowed(false);
+  ctx->setResultWriter(NULL);
+  this->_result_pos = 0;
+  this->_state = 3;
+}
+
+/**
+ * Write the result to the serial port using the HEX encoding.
+ *
+ * No more characters are written if the time budget has been used or the
+ * send buffer of the port is full. Only one character is written at a time
+ * if the port does not report the free space of its send buffer.
+ *
+ * @param start: The start of the time budget as returned by RPC_MICROS()
+ * @param budget_us: The time budget in microseconds
+ * @return true if the result has been written | false if not
+ */
+bool ArduRPC_Serial::processResultHex(uint32_t start, uint32_t budget_us)
+{
+  uint8_t *data;
+  uint16_t end;
+  uint16_t pos;
+  int space;
+  char c;
+
+  if (this->_state != 3) {
+    return false;
+  }
+
+  // ':', two characters per byte and '\n'
+  data = this->_rpc->getResultData();
+  end = 2 * this->_rpc->getResultLength() + 2;
+  if (end == 2) {
+    end = 0;
+  }
+
+  while (this->_result_pos < end) {
+    if (RPC_MICROS() - start >= budget_us) {
+      return false;
     }
-    this->_serial->print('\n');
+    space = this->_serial->availableForWrite();
+    if (space < 1) {
+      space = 1;
+    }
+    for (; space > 0 && this->_result_pos < end; space--) {
+      pos = this->_result_pos++;
+      if (pos == 0) {
+        c = ':';
+      } else if (pos == end - 1) {
+        c = '\n';
+      } else if (pos & 1) {
+        c = rpc_hex_encode(data[(pos - 1) / 2] >> 4);
+      } else {
+        c = rpc_hex_encode(data[(pos - 1) / 2]);
+      }
+      this->_serial->write(c);
+    }
+  }
+  this->_state = 0;
+  return true;
+}
+
+/**
+ * Write a part of a large result to the serial port using the HEX encoding.
+ *
+ * A part starts with a semicolon (';'). The last part of the result is sent
+ * with the return code by processResultHex().
+ *
+ * The context of the request is not needed, there is only one connection.
+ *
+ * @param data: The result data
+ * @param length: Number of bytes
+ */
+void ArduRPC_Serial::writeResultChunk(ArduRPCContext *, uint8_t *data, uint8_t length)
+{
+  this->_serial->print(";");
+  this->writeHex(data, length);
+  this->_serial->print('\n');
+}
+
+/**
+ * Execute subscribed commands and send a notification if required.
+ *
+ * A notification starts with an exclamation mark ('!') followed by the ID of
+ * the subscription and the result of the command.
+ */
+void ArduRPC_Serial::processSubscriptions()
+{
+  uint8_t subscription_id;
+  ArduRPCContext *ctx;
+
+  ctx = this->_rpc->getContext();
+  subscription_id = this->_rpc->pollSubscriptions(ctx);
+  if (subscription_id == 0xff) {
+    return;
+  }
+
+  this->_serial->print("!");
+  this->writeHex(&subscription_id, 1);
+  this->writeHex(ctx->getResultData(), ctx->getResultLength());
+  this->_serial->print('\n');
 }
 
 /**
  * Read and process data from the serial port specified
+ *
+ * While a request is pending only priority requests are read. The next
+ * request is processed after the result has been sent.
  */
 void ArduRPC_Serial::readData()
 {
   uint8_t c;
 
+  if (this->_state == 2) {
+    if (this->_rpc->getContext()->isPending()) {
+      this->readPriority();
+      return;
+    }
+    this->finishRequest();
+  }
+
+  if (this->_state == 3) {
+    this->processResultHex(RPC_MICROS(), RPC_SERIAL_NO_LIMIT);
+  }
+
   if (this->_serial->available() < 1) {
+    // Only use the context if no request is received at the moment
+    if (this->_state == 0) {
+      this->processSubscriptions();
+    }
     return;
   }
 
   c = this->_serial->read();
 
+  if (this->receivePriority(c)) {
+    return;
+  }
+
   if (this->_state == 1) {
     processDataHex(c);
   }
 
   if (this->_state == 0 && c == ':') {
-    this->_state = 1;
-    this->_rpc->reset();
-    this->_tmp_data_part = 0;
+    this->startRequest();
+  }
+}
+
+/**
+ * Write data to the serial port using the HEX encoding.
+ *
+ * @param data: The data to write
+ * @param len: Number of bytes
+ */
+void ArduRPC_Serial::writeHex(uint8_t *data, uint8_t len)
+{
+  uint8_t i;
+
+  for (i = 0; i < len; i++) {
+    if (data[0] < 0x10)
+      this->_serial->print('0');
+    this->_serial->print(data[0], HEX);
+    data++;
   }
 }
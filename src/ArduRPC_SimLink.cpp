@@ -0,0 +1,227 @@
+/**
+ * Arduino Remote Procedure Calls - ArduRPC
+ * Copyright (C) 2013-2016 DinoTools
+ *
+ * This file is part of ArduRPC.
+ *
+ * ArduRPC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * ArduRPC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ArduRPC.h"
+
+
+/**
+ * The constructor.
+ *
+ * @param baud Baud rate, every byte takes 10 bits (8N1)
+ * @param latency Propagation delay in microseconds
+ * @param buffer_size Size of the receive buffer of both ports (64 on most boards)
+ * @param line_size Maximum number of bytes on the line in every direction
+ */
+ArduRPC_SimLink::ArduRPC_SimLink(uint32_t baud, uint32_t latency, uint16_t buffer_size, uint16_t line_size)
+{
+  this->_byte_time = 10000000UL / baud;
+  this->_latency = latency;
+  this->setErrorRates(0, 0);
+  this->a.init(this, &this->b, buffer_size, line_size);
+  this->b.init(this, &this->a, buffer_size, line_size);
+}
+
+/**
+ * Set the rate of lost and corrupted bytes.
+ *
+ * The errors are generated with a pseudo random number generator. The same
+ * seed results in the same errors.
+ *
+ * @param loss_rate Lost bytes per 65536 bytes
+ * @param corruption_rate Bytes with a flipped bit per 65536 bytes
+ * @param seed Seed of the pseudo random number generator, must not be 0
+ */
+void ArduRPC_SimLink::setErrorRates(uint16_t loss_rate, uint16_t corruption_rate, uint32_t seed)
+{
+  this->_loss_rate = loss_rate;
+  this->_corruption_rate = corruption_rate;
+  this->_random_state = seed;
+}
+
+/**
+ * Get the next pseudo random number (xorshift32).
+ */
+uint32_t ArduRPC_SimLink::random()
+{
+  this->_random_state ^= this->_random_state << 13;
+  this->_random_state ^= this->_random_state >> 17;
+  this->_random_state ^= this->_random_state << 5;
+  return this->_random_state;
+}
+
+/**
+ * The constructor. The port is initialized by ArduRPC_SimLink.
+ */
+ArduRPC_SimLinkPort::ArduRPC_SimLinkPort()
+{
+}
+
+/**
+ * The destructor frees the buffers.
+ */
+ArduRPC_SimLinkPort::~ArduRPC_SimLinkPort()
+{
+  free(this->_buffer);
+  free(this->_line);
+}
+
+/**
+ * Allocate the buffers and reset the counters.
+ *
+ * @param link The link
+ * @param peer The other end of the link
+ * @param buffer_size Size of the receive buffer
+ * @param line_size Maximum number of bytes on the line
+ */
+void ArduRPC_SimLinkPort::init(ArduRPC_SimLink *link, ArduRPC_SimLinkPort *peer, uint16_t buffer_size, uint16_t line_size)
+{
+  this->_link = link;
+  this->_peer = peer;
+  memset(&this->_stats, 0, sizeof(this->_stats));
+  this->_buffer = (uint8_t *)malloc(buffer_size);
+  this->_buffer_size = buffer_size;
+  this->_buffer_pos = 0;
+  this->_buffer_count = 0;
+  this->_line = (rpc_sim_link_byte_t *)malloc(sizeof(rpc_sim_link_byte_t) * line_size);
+  this->_line_size = line_size;
+  this->_line_pos = 0;
+  this->_line_count = 0;
+  this->_time_free = RPC_MICROS();
+}
+
+/**
+ * Move the bytes arrived until now from the line into the receive buffer.
+ *
+ * Bytes arriving while the buffer is full are dropped.
+ */
+void ArduRPC_SimLinkPort::update()
+{
+  uint32_t now = RPC_MICROS();
+  rpc_sim_link_byte_t *b;
+
+  while (this->_line_count > 0) {
+    b = &this->_line[this->_line_pos];
+    if ((int32_t)(now - b->time) < 0) {
+      break;
+    }
+    if (this->_buffer_count < this->_buffer_size) {
+      this->_buffer[(this->_buffer_pos + this->_buffer_count) % this->_buffer_size] = b->data;
+      this->_buffer_count++;
+      this->_stats.received++;
+    } else {
+      this->_stats.overflows++;
+    }
+    this->_line_pos = (this->_line_pos + 1) % this->_line_size;
+    this->_line_count--;
+  }
+}
+
+/**
+ * @return Number of bytes in the receive buffer
+ */
+int ArduRPC_SimLinkPort::available()
+{
+  this->update();
+  return this->_buffer_count;
+}
+
+/**
+ * @return The next byte without removing it or -1 if no byte is available
+ */
+int ArduRPC_SimLinkPort::peek()
+{
+  this->update();
+  if (this->_buffer_count == 0) {
+    return -1;
+  }
+  return this->_buffer[this->_buffer_pos];
+}
+
+/**
+ * @return The next byte or -1 if no byte is available
+ */
+int ArduRPC_SimLinkPort::read()
+{
+  uint8_t c;
+
+  this->update();
+  if (this->_buffer_count == 0) {
+    return -1;
+  }
+  c = this->_buffer[this->_buffer_pos];
+  this->_buffer_pos = (this->_buffer_pos + 1) % this->_buffer_size;
+  this->_buffer_count--;
+  return c;
+}
+
+/**
+ * Send a byte to the other end of the link.
+ *
+ * The byte is sent after all previously written bytes. Like a hardware
+ * serial port with a large send buffer the function does not wait.
+ *
+ * @param c The byte
+ * @return 1 on success | 0 if the line is full
+ */
+size_t ArduRPC_SimLinkPort::write(uint8_t c)
+{
+  ArduRPC_SimLink *link = this->_link;
+  ArduRPC_SimLinkPort *peer = this->_peer;
+  uint32_t now = RPC_MICROS();
+  rpc_sim_link_byte_t *b;
+
+  if (peer->_line_count >= peer->_line_size) {
+    return 0;
+  }
+
+  if ((int32_t)(this->_time_free - now) < 0) {
+    this->_time_free = now;
+  }
+  this->_time_free += link->_byte_time;
+  this->_stats.sent++;
+
+  if (link->_loss_rate > 0 && (link->random() & 0xffff) < link->_loss_rate) {
+    this->_stats.lost++;
+    return 1;
+  }
+  if (link->_corruption_rate > 0 && (link->random() & 0xffff) < link->_corruption_rate) {
+    c ^= 1 << (link->random() & 0x07);
+    this->_stats.corrupted++;
+  }
+
+  b = &peer->_line[(peer->_line_pos + peer->_line_count) % peer->_line_size];
+  b->time = this->_time_free + link->_latency;
+  b->data = c;
+  peer->_line_count++;
+  return 1;
+}
+
+/**
+ * Get the counters of the port.
+ *
+ * The sent, lost and corrupted counters refer to the bytes written to this
+ * port, the received and overflows counters to the bytes received by it.
+ *
+ * @return The counters
+ */
+rpc_sim_link_stats_t *ArduRPC_SimLinkPort::getStats()
+{
+  return &this->_stats;
+}
@@ -0,0 +1,467 @@
+/**
+ * Arduino Remote Procedure Calls - ArduRPC
+ * Copyright (C) 2013-2016 DinoTools
+ *
+ * This file is part of ArduRPC.
+ *
+ * ArduRPC is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * ArduRPC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "ArduRPC.h"
+
+#if defined(__linux__)
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/**
+ * The constructor.
+ *
+ * @param rpc: Specify the rpc handler to use
+ * @param max_connections: Maximum number of connections, further connections are closed at once
+ */
+ArduRPC_Socket::ArduRPC_Socket(ArduRPC &rpc, uint32_t max_connections)
+{
+  this->_rpc = &rpc;
+  this->_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  this->_current = NULL;
+  this->_contexts = NULL;
+  this->_context_count = 0;
+  this->_context_size = 0;
+  this->_connection_count = 0;
+  this->_max_connections = max_connections;
+}
+
+/**
+ * Accept all waiting connections of a listening socket.
+ *
+ * @param listener: The listening socket
+ */
+void ArduRPC_Socket::acceptConnections(rpc_socket_connection_t *listener)
+{
+  int fd;
+  int flag = 1;
+
+  while (1) {
+    fd = accept4(listener->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      return;
+    }
+    if (this->_connection_count >= this->_max_connections) {
+      close(fd);
+      continue;
+    }
+    // Fails on Unix domain sockets
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    if (!this->addSocket(fd, false)) {
+      close(fd);
+      continue;
+    }
+    this->_connection_count++;
+  }
+}
+
+/**
+ * Register a socket with the event loop.
+ *
+ * @param fd: The socket
+ * @param listener: true if the socket accepts new connections
+ * @return true on success | false if the memory could not be allocated or the socket could not be registered
+ */
+bool ArduRPC_Socket::addSocket(int fd, bool listener)
+{
+  rpc_socket_connection_t *connection;
+  struct epoll_event event;
+
+  connection = (rpc_socket_connection_t *)calloc(1, sizeof(rpc_socket_connection_t));
+  if (connection == NULL) {
+    return false;
+  }
+  connection->fd = fd;
+  connection->listener = listener;
+  connection->events = EPOLLIN;
+
+  event.events = connection->events;
+  event.data.ptr = connection;
+  if (epoll_ctl(this->_epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+    free(connection);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Close a connection and release its memory.
+ *
+ * @param connection: The connection
+ */
+void ArduRPC_Socket::closeConnection(rpc_socket_connection_t *connection)
+{
+  epoll_ctl(this->_epoll_fd, EPOLL_CTL_DEL, connection->fd, NULL);
+  close(connection->fd);
+  this->releaseContext(connection);
+  free(connection->output);
+  free(connection);
+  this->_connection_count--;
+}
+
+/**
+ * Write as much of the unsent data as the socket accepts.
+ *
+ * @param connection: The connection
+ * @return true on success | false if the connection has failed
+ */
+bool ArduRPC_Socket::flushOutput(rpc_socket_connection_t *connection)
+{
+  ssize_t len;
+  uint32_t pos = 0;
+
+  while (pos < connection->output_length) {
+    len = send(connection->fd, &connection->output[pos], connection->output_length - pos, MSG_NOSIGNAL);
+    if (len < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      return false;
+    }
+    pos += len;
+  }
+  if (pos > 0) {
+    memmove(connection->output, &connection->output[pos], connection->output_length - pos);
+    connection->output_length -= pos;
+  }
+  return this->updateEvents(connection);
+}
+
+/**
+ * Get the number of open connections.
+ *
+ * @return Number of connections
+ */
+uint32_t ArduRPC_Socket::getConnectionCount()
+{
+  return this->_connection_count;
+}
+
+/**
+ * Listen for TCP connections.
+ *
+ * @param port: The port
+ * @param address: The IPv4 address to bind to, the loopback address by default
+ * @return true on success | false if the socket could not be created
+ */
+bool ArduRPC_Socket::listenTCP(uint16_t port, const char *address)
+{
+  struct sockaddr_in addr;
+  int fd;
+  int flag = 1;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if (inet_pton(AF_INET, address, &addr.sin_addr) != 1) {
+    return false;
+  }
+
+  fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return false;
+  }
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0 || !this->addSocket(fd, true)) {
+    close(fd);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Listen for connections on a Unix domain socket.
+ *
+ * A socket file left by a previous run is removed. Other files are kept and
+ * the call fails.
+ *
+ * @param path: The path of the socket file
+ * @return true on success | false if the socket could not be created
+ */
+bool ArduRPC_Socket::listenUnix(const char *path)
+{
+  struct sockaddr_un addr;
+  struct stat st;
+  int fd;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    return false;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+    unlink(path);
+  }
+
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return false;
+  }
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0 || !this->addSocket(fd, true)) {
+    close(fd);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Wait for events and process them.
+ *
+ * Call this function in the main loop of the host application. Only sockets
+ * with events are processed.
+ *
+ * @param timeout_ms: Time to wait for an event in milliseconds. 0 = do not wait; -1 = wait until an event occurs
+ * @return Number of handled events | -1 on error
+ */
+int ArduRPC_Socket::poll(int timeout_ms)
+{
+  struct epoll_event events[RPC_SOCKET_MAX_EVENTS];
+  rpc_socket_connection_t *connection;
+  int count;
+  int i;
+
+  count = epoll_wait(this->_epoll_fd, events, RPC_SOCKET_MAX_EVENTS, timeout_ms);
+  if (count < 0) {
+    return errno == EINTR ? 0 : -1;
+  }
+
+  for (i = 0; i < count; i++) {
+    connection = (rpc_socket_connection_t *)events[i].data.ptr;
+    if (connection->listener) {
+      this->acceptConnections(connection);
+      continue;
+    }
+    if ((events[i].events & EPOLLOUT) && !this->flushOutput(connection)) {
+      this->closeConnection(connection);
+      continue;
+    }
+    if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !this->processConnection(connection)) {
+      this->closeConnection(connection);
+    }
+  }
+  return count;
+}
+
+/**
+ * Read and process one chunk of data from a connection.
+ *
+ * Complete requests are processed at once. Their results are collected and
+ * sent together at the end of the chunk.
+ *
+ * @param connection: The connection
+ * @return true on success | false if the connection has been closed or has failed
+ */
+bool ArduRPC_Socket::processConnection(rpc_socket_connection_t *connection)
+{
+  uint8_t buf[RPC_SOCKET_CHUNK_SIZE];
+  uint8_t c;
+  ssize_t len;
+  ssize_t i;
+  ArduRPCContext *ctx;
+
+  if (connection->output_length > RPC_SOCKET_MAX_OUTPUT) {
+    // Wait until the peer has read the results
+    return true;
+  }
+
+  len = recv(connection->fd, buf, sizeof(buf), 0);
+  if (len == 0) {
+    return false;
+  }
+  if (len < 0) {
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+  }
+
+  for (i = 0; i < len; i++) {
+    c = buf[i];
+    ctx = connection->ctx;
+
+    if (connection->state == 1) {
+      if (c == '\r') {
+        continue;
+      }
+
+      if (c == '\n') {
+        this->_current = connection;
+        ctx->setResultWriter(this);
+        this->_rpc->process(ctx);
+        ctx->setResultWriter(NULL);
+        this->_current = NULL;
+        if (ctx->getResultLength() > 0 &&
+            !this->writeFrameHex(connection, ':', ctx->getResultData(), ctx->getResultLength())) {
+          return false;
+        }
+        this->releaseContext(connection);
+        continue;
+      }
+
+      c = rpc_hex_decode(c);
+      if (connection->tmp_data_part == 0) {
+        connection->tmp_data = c << 4;
+        connection->tmp_data_part = 1;
+      } else {
+        ctx->writeData(connection->tmp_data | c);
+        connection->tmp_data_part = 0;
+      }
+      continue;
+    }
+
+    if (c == ':') {
+      if (this->_context_count > 0) {
+        ctx = this->_contexts[--this->_context_count];
+      } else {
+        ctx = new ArduRPCContext();
+      }
+      ctx->reset();
+      connection->ctx = ctx;
+      connection->state = 1;
+      connection->tmp_data_part = 0;
+    }
+  }
+  return this->flushOutput(connection);
+}
+
+/**
+ * Return the context of a connection to the pool.
+ *
+ * @param connection: The connection
+ */
+void ArduRPC_Socket::releaseContext(rpc_socket_connection_t *connection)
+{
+  ArduRPCContext **contexts;
+
+  connection->state = 0;
+  if (connection->ctx == NULL) {
+    return;
+  }
+  if (this->_context_count == this->_context_size) {
+    contexts = (ArduRPCContext **)realloc(this->_contexts, sizeof(ArduRPCContext *) * (this->_context_size + 16));
+    if (contexts == NULL) {
+      delete connection->ctx;
+      connection->ctx = NULL;
+      return;
+    }
+    this->_contexts = contexts;
+    this->_context_size += 16;
+  }
+  this->_contexts[this->_context_count++] = connection->ctx;
+  connection->ctx = NULL;
+}
+
+/**
+ * Register the events to wait for.
+ *
+ * Wait until the socket is writable while data has not been sent. Stop
+ * reading while more than RPC_SOCKET_MAX_OUTPUT bytes have not been sent.
+ *
+ * @param connection: The connection
+ * @return true on success | false if the events could not be changed
+ */
+bool ArduRPC_Socket::updateEvents(rpc_socket_connection_t *connection)
+{
+  struct epoll_event event;
+  uint32_t events = 0;
+
+  if (connection->output_length <= RPC_SOCKET_MAX_OUTPUT) {
+    events |= EPOLLIN;
+  }
+  if (connection->output_length > 0) {
+    events |= EPOLLOUT;
+  }
+  if (events == connection->events) {
+    return true;
+  }
+  connection->events = events;
+  event.events = events;
+  event.data.ptr = connection;
+  return epoll_ctl(this->_epoll_fd, EPOLL_CTL_MOD, connection->fd, &event) == 0;
+}
+
+/**
+ * Encode data as hex string and append it to the unsent data of a connection.
+ *
+ * @param connection: The connection
+ * @param start: The first character of the frame
+ * @param data: The data
+ * @param length: Number of bytes
+ * @return true on success | false if the memory could not be allocated
+ */
+bool ArduRPC_Socket::writeFrameHex(rpc_socket_connection_t *connection, char start, uint8_t *data, uint8_t length)
+{
+  uint32_t size;
+  uint8_t *output;
+  uint8_t *dst;
+  uint8_t i;
+
+  size = connection->output_length + 2 * length + 2;
+  if (size > connection->output_size) {
+    output = (uint8_t *)realloc(connection->output, size + RPC_MAX_DATA_LENGTH);
+    if (output == NULL) {
+      return false;
+    }
+    connection->output = output;
+    connection->output_size = size + RPC_MAX_DATA_LENGTH;
+  }
+
+  dst = &connection->output[connection->output_length];
+  *dst++ = start;
+  for (i = 0; i < length; i++) {
+    *dst++ = rpc_hex_encode(data[i] >> 4);
+    *dst++ = rpc_hex_encode(data[i]);
+  }
+  *dst++ = '\n';
+  connection->output_length = size;
+  return true;
+}
+
+/**
+ * Write a part of a large result to the connection of the request.
+ *
+ * A part starts with a semicolon (';'). The last part of the result is sent
+ * with the return code.
+ *
+ * @param ctx: The context of the request
+ * @param data: The result data
+ * @param length: Number of bytes
+ */
+void ArduRPC_Socket::writeResultChunk(ArduRPCContext *ctx, uint8_t *data, uint8_t length)
+{
+  if (this->_current == NULL || this->_current->ctx != ctx) {
+    return;
+  }
+  this->writeFrameHex(this->_current, ';', data, length);
+}
+
+#endif
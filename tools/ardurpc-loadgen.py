@@ -0,0 +1,150 @@
+#!/usr/bin/env python3
+#
+# Arduino Remote Procedure Calls - ArduRPC
+# Copyright (C) 2013-2016 DinoTools
+#
+# This file is part of ArduRPC.
+#
+# ArduRPC is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as
+# published by the Free Software Foundation, either version 3 of
+# the License, or (at your option) any later version.
+#
+# ArduRPC is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library. If not, see <http://www.gnu.org/licenses/>.
+"""
+Measure the latency and the throughput of an ArduRPC socket server.
+
+Idle connections are opened first and kept open without sending anything.
+Every active client then sends a request, waits for the result and sends
+the next request until the time is up. The latency of every request is
+measured from sending the request to receiving the complete result.
+
+Examples::
+
+    ardurpc-loadgen.py --host 127.0.0.1:1234 --clients 16 --idle 5000
+    ardurpc-loadgen.py --unix /tmp/ardurpc.sock --handler 0xff --command 0x03
+"""
+
+import argparse
+import resource
+import selectors
+import socket
+import sys
+import time
+
+
+def connect(args):
+    if args.unix is not None:
+        sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        sock.connect(args.unix)
+    else:
+        address, port = args.host.rsplit(":", 1)
+        sock = socket.create_connection((address, int(port)))
+        sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    return sock
+
+
+def percentile(values, p):
+    if not values:
+        return 0.0
+    index = min(len(values) - 1, int(round(p / 100.0 * (len(values) - 1))))
+    return values[index]
+
+
+def raise_file_limit(count):
+    soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+    if soft != resource.RLIM_INFINITY and soft < count:
+        limit = count if hard == resource.RLIM_INFINITY else min(count, hard)
+        resource.setrlimit(resource.RLIMIT_NOFILE, (limit, hard))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    target = parser.add_mutually_exclusive_group(required=True)
+    target.add_argument("--host", help="TCP server as host:port")
+    target.add_argument("--unix", help="Path of a Unix domain socket")
+    parser.add_argument("--clients", type=int, default=1, help="Number of active clients")
+    parser.add_argument("--idle", type=int, default=0, help="Number of idle connections")
+    parser.add_argument("--duration", type=float, default=5.0, help="Time to send requests in seconds")
+    parser.add_argument("--handler", type=lambda v: int(v, 0), default=0xff, help="Handler ID")
+    parser.add_argument("--command", type=lambda v: int(v, 0), default=0x01, help="Command ID")
+    parser.add_argument("--params", default="", help="Parameters as hex string")
+    args = parser.parse_args()
+
+    params = bytes.fromhex(args.params)
+    data = bytes([0, args.handler, args.command, len(params)]) + params
+    request = (":" + "".join("%02X" % b for b in data) + "\n").encode("ascii")
+
+    raise_file_limit(args.idle + args.clients + 64)
+    idle = [connect(args) for _ in range(args.idle)]
+
+    selector = selectors.DefaultSelector()
+    clients = []
+    for _ in range(args.clients):
+        sock = connect(args)
+        sock.setblocking(False)
+        client = {"sock": sock, "buf": b"", "start": 0.0}
+        selector.register(sock, selectors.EVENT_READ, client)
+        clients.append(client)
+
+    latencies = []
+    errors = 0
+    start = time.perf_counter()
+    end = start + args.duration
+    for client in clients:
+        client["start"] = time.perf_counter()
+        client["sock"].sendall(request)
+
+    active = len(clients)
+    while active > 0:
+        for key, _ in selector.select(timeout=1.0):
+            client = key.data
+            chunk = client["sock"].recv(65536)
+            if not chunk:
+                print("Connection closed by the server", file=sys.stderr)
+                return 1
+            client["buf"] += chunk
+            while b"\n" in client["buf"]:
+                line, client["buf"] = client["buf"].split(b"\n", 1)
+                if not line.startswith(b":"):
+                    # Parts of large results
+                    continue
+                now = time.perf_counter()
+                latencies.append(now - client["start"])
+                if line[1:3] != b"00":
+                    errors += 1
+                if now < end:
+                    client["start"] = now
+                    client["sock"].sendall(request)
+                else:
+                    selector.unregister(client["sock"])
+                    active -= 1
+        if time.perf_counter() > end + 5.0:
+            print("Timeout waiting for results", file=sys.stderr)
+            return 1
+    elapsed = time.perf_counter() - start
+
+    latencies.sort()
+    print("connections: %d active, %d idle" % (len(clients), len(idle)))
+    print("requests:    %d in %.2f s, %d errors" % (len(latencies), elapsed, errors))
+    print("throughput:  %.0f requests/s" % (len(latencies) / elapsed))
+    print("latency:     p50 %.1f us, p99 %.1f us, max %.1f us" % (
+        percentile(latencies, 50) * 1e6,
+        percentile(latencies, 99) * 1e6,
+        latencies[-1] * 1e6 if latencies else 0.0,
+    ))
+    for sock in idle:
+        sock.close()
+    for client in clients:
+        client["sock"].close()
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
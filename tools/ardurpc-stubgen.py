@@ -0,0 +1,470 @@
+#!/usr/bin/env python3
+#
+# Arduino Remote Procedure Calls - ArduRPC
+# Copyright (C) 2013-2016 DinoTools
+#
+# This file is part of ArduRPC.
+#
+# ArduRPC is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as
+# published by the Free Software Foundation, either version 3 of
+# the License, or (at your option) any later version.
+#
+# ArduRPC is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library. If not, see <http://www.gnu.org/licenses/>.
+"""
+Generate typed C++ client stubs for ArduRPCRequest.
+
+The handler types and their commands are read from the schema, by default
+doc/source/user/handler.rst. The handlers of a device are read from a JSON
+description or from the system handler of a running device.
+
+Device description::
+
+    {
+        "name": "Lamp",
+        "handlers": [
+            {"id": 0, "type": "0x0180", "name": "strip"}
+        ]
+    }
+
+Examples::
+
+    ardurpc-stubgen.py --device lamp.json -o Lamp.h
+    ardurpc-stubgen.py --port /dev/ttyUSB0 --name Lamp --save-device lamp.json -o Lamp.h
+    ardurpc-stubgen.py --host 192.168.1.10:1234 --name Lamp --cache ~/.ardurpc -o Lamp.h
+    ardurpc-stubgen.py --all -o ArduRPCStubs.h
+"""
+
+import argparse
+import json
+import os
+import re
+import socket
+import sys
+
+DEFAULT_SCHEMA = os.path.join(
+    os.path.dirname(os.path.abspath(__file__)),
+    "..", "doc", "source", "user", "handler.rst"
+)
+
+RPC_UINT8 = 0x02
+RPC_UINT16 = 0x04
+RPC_UINT32 = 0x06
+RPC_STRING = 0x11
+RPC_MCARRAY = 0x12
+
+#: Types supported by ArduRPCRequest::call() and ArduRPCRequest::invoke()
+TYPES = {
+    "int8_t": "int8_t",
+    "uint8_t": "uint8_t",
+    "int16_t": "int16_t",
+    "uint16_t": "uint16_t",
+    "int32_t": "int32_t",
+    "uint32_t": "uint32_t",
+    "float": "float",
+    "uint8": "uint8_t",
+    "uint16": "uint16_t",
+    "boolean": "uint8_t",
+    "char": "uint8_t",
+    "unsigned char": "uint8_t",
+}
+
+
+class HandlerType(object):
+    def __init__(self, start, end, mask, name, label):
+        self.start = start
+        self.end = end
+        self.mask = mask
+        self.name = name
+        self.label = label
+
+    def matches(self, handler_type):
+        return self.start <= handler_type <= self.end and \
+            (handler_type >> (16 - self.mask)) == (self.start >> (16 - self.mask))
+
+    @property
+    def class_name(self):
+        return "ArduRPCStub_" + re.sub(r"[^A-Za-z0-9]", "", self.name.title())
+
+
+class Command(object):
+    def __init__(self, command_id, name, return_type, params):
+        self.command_id = command_id
+        self.name = name
+        self.return_type = return_type
+        self.params = params
+
+    def unsupported(self):
+        """Return the reason why no stub can be generated or None."""
+        if self.return_type != "void" and self.return_type not in TYPES:
+            return "result type %s" % self.return_type
+        for param_type, param_name in self.params:
+            if param_type not in TYPES:
+                return "parameter %s %s" % (param_type, param_name)
+        return None
+
+
+class Schema(object):
+    """The handler types and commands documented in handler.rst."""
+
+    def __init__(self, filename):
+        with open(filename) as f:
+            self.lines = f.read().splitlines()
+        self.types = self._parse_types()
+        self.signatures = self._parse_signatures()
+
+    def _parse_types(self):
+        types = []
+        for line in self.lines:
+            m = re.match(
+                r"^\|\s*(0x[0-9A-Fa-f]{4})\s*(?:\|\s*(0x[0-9A-Fa-f]{4})\s*)?\|\s*(\d*)\s*\|\s*:ref:`([^`]*)`",
+                line
+            )
+            if m is None:
+                continue
+            start = int(m.group(1), 16)
+            end = int(m.group(2), 16) if m.group(2) else start
+            mask = int(m.group(3)) if m.group(2) else 16
+            ref = m.group(4)
+            m = re.match(r"^(.*?)\s*<(.*)>$", ref)
+            if m:
+                name, label = m.group(1), m.group(2)
+            else:
+                name, label = ref, ref
+            types.append(HandlerType(start, end, mask, name, label.lower()))
+        return types
+
+    def _parse_signatures(self):
+        signatures = {}
+        for line in self.lines:
+            m = re.match(r"^\.\. cpp:function:: (.+?)\s+(\w+)::(\w+)\((.*)\)\s*$", line)
+            if m is None:
+                continue
+            params = []
+            for param in [p.strip() for p in m.group(4).split(",") if p.strip()]:
+                param = param.replace("[]", " *")
+                pm = re.match(r"^(.*?)\s*(\**)\s*(\w+)$", param)
+                params.append((pm.group(1) + pm.group(2), pm.group(3)))
+            key = (m.group(2), m.group(3))
+            signatures.setdefault(key, []).append((m.group(1), params))
+        return signatures
+
+    def find_type(self, handler_type):
+        """Return the most specific handler type or None."""
+        found = None
+        for t in self.types:
+            if t.matches(handler_type) and (found is None or t.mask > found.mask):
+                found = t
+        return found
+
+    def commands(self, handler_type):
+        """Return the commands of the given handler type."""
+        lines = self.lines
+        start = None
+        for i, line in enumerate(lines):
+            if line.strip().lower() == ".. _%s:" % handler_type.label:
+                start = i
+                break
+        if start is None:
+            return []
+
+        column = None
+        commands = []
+        used = {}
+        for line in lines[start + 1:]:
+            if re.match(r"^\.\. _.*:$", line) and commands:
+                break
+            if line.startswith(".. cpp:function::") and commands:
+                break
+            cells = [c.strip() for c in line.strip().strip("|").split("|")] if line.startswith("|") else []
+            if len(cells) > 2 and cells[0] == "" and cells[1] == "":
+                # Header with the columns of the subtypes
+                for n, cell in enumerate(cells[2:]):
+                    if handler_type.name.lower().startswith(cell.lower()):
+                        column = n + 2
+                continue
+            if len(cells) < 2:
+                continue
+            m = re.match(r"^(0x[0-9A-Fa-f]{2})$", cells[0])
+            f = re.match(r"^:cpp:func:`(\w+)::(\w+)`$", cells[1])
+            if m is None or f is None:
+                continue
+            if column is not None and (len(cells) <= column or cells[column].lower() != "x"):
+                continue
+            key = (f.group(1), f.group(2))
+            signatures = self.signatures.get(key, [])
+            n = used.get(key, 0)
+            used[key] = n + 1
+            if n >= len(signatures):
+                continue
+            return_type, params = signatures[n]
+            commands.append(Command(int(m.group(1), 16), f.group(2), return_type, params))
+        return commands
+
+
+class Connection(object):
+    """Send requests to a device using the hex encoding."""
+
+    def __init__(self, port=None, baud=9600, host=None, timeout=2.0):
+        self.buf = b""
+        if host is not None:
+            address, port_number = host.rsplit(":", 1)
+            self.sock = socket.create_connection((address, int(port_number)), timeout)
+            self.serial = None
+        else:
+            import serial
+            self.serial = serial.Serial(port, baud, timeout=timeout)
+            self.sock = None
+
+    def _readline(self):
+        while b"\n" not in self.buf:
+            if self.sock is not None:
+                data = self.sock.recv(256)
+            else:
+                data = self.serial.read(max(1, self.serial.in_waiting))
+            if not data:
+                raise IOError("No response from device")
+            self.buf += data
+        line, self.buf = self.buf.split(b"\n", 1)
+        return line.strip(b"\r").decode("ascii")
+
+    def call(self, handler_id, command_id, params=b""):
+        data = bytes([0, handler_id, command_id, len(params)]) + params
+        line = ":" + "".join("%02X" % b for b in data) + "\n"
+        if self.sock is not None:
+            self.sock.sendall(line.encode("ascii"))
+        else:
+            self.serial.write(line.encode("ascii"))
+        result = b""
+        while True:
+            line = self._readline()
+            if line.startswith(";"):
+                result += bytes.fromhex(line[1:])
+            elif line.startswith(":"):
+                data = bytes.fromhex(line[1:])
+                if data[0] != 0:
+                    raise IOError("Command 0x%02x failed with code %d" % (command_id, data[0]))
+                return result + data[1:]
+
+    def fingerprint(self):
+        """Read the fingerprint of the device."""
+        data = self.call(0xff, 0x05)
+        if data[0] != RPC_UINT32:
+            raise IOError("Unexpected fingerprint")
+        return (data[1] << 24) | (data[2] << 16) | (data[3] << 8) | data[4]
+
+    def handlers(self):
+        """Read the handler list and names with the system handler."""
+        data = self.call(0xff, 0x20)
+        if data[0] != RPC_MCARRAY or data[2:4] != bytes([RPC_UINT8, RPC_UINT16]):
+            raise IOError("Unexpected handler list")
+        handlers = []
+        for i in range(data[4]):
+            row = data[5 + i * 3:8 + i * 3]
+            handler_id = row[0]
+            name = self.call(0xff, 0x21, bytes([handler_id]))
+            if name[0] != RPC_STRING:
+                raise IOError("Unexpected handler name")
+            name = name[2:2 + name[1]].split(b"\0")[0].decode("ascii", "replace")
+            handlers.append({
+                "id": handler_id,
+                "type": (row[1] << 8) | row[2],
+                "name": name or "handler%d" % handler_id,
+            })
+        return handlers
+
+
+def identifier(name):
+    name = re.sub(r"[^A-Za-z0-9_]", "_", name)
+    if re.match(r"^\d", name):
+        name = "_" + name
+    return name
+
+
+def generate_class(handler_type, commands):
+    lines = []
+    lines.append("/**")
+    lines.append(" * Client stub for the handler type %s (0x%04X)." % (handler_type.name, handler_type.start))
+    lines.append(" */")
+    lines.append("class %s" % handler_type.class_name)
+    lines.append("{")
+    lines.append("  public:")
+    lines.append("    %s(ArduRPCRequest &request, uint8_t handler_id)" % handler_type.class_name)
+    lines.append("    {")
+    lines.append("      this->request = &request;")
+    lines.append("      this->handler_id = handler_id;")
+    lines.append("    }")
+    names = {}
+    for command in commands:
+        name = re.sub(r"([A-Z]+)([A-Z][a-z])", r"\1_\2", command.name)
+        name = "CMD_" + re.sub(r"([a-z0-9])([A-Z])", r"\1_\2", name).upper()
+        names[name] = names.get(name, 0) + 1
+        if names[name] > 1:
+            # Overloaded command
+            name += "_%d" % names[name]
+        lines.append("    //! Command ID of %s()" % command.name)
+        lines.append("    static const uint8_t %s = 0x%02X;" % (name, command.command_id))
+    for command in commands:
+        reason = command.unsupported()
+        if reason is not None:
+            lines.append("    // %s() is not generated: unsupported %s" % (command.name, reason))
+            continue
+        params = ", ".join("%s %s" % (TYPES[t], n) for t, n in command.params)
+        args = "".join(", %s" % n for t, n in command.params)
+        if command.return_type == "void":
+            lines.append("    bool %s(%s)" % (command.name, params))
+            lines.append("    {")
+            # call<>() resets the request, call() without parameters would send it as it is
+            lines.append("      return this->request->call%s(this->handler_id, 0x%02X%s) &&" % (
+                "" if args else "<>", command.command_id, args))
+            lines.append("        this->request->return_code == RPC_RETURN_SUCCESS;")
+        else:
+            result_type = TYPES[command.return_type]
+            lines.append("    %s %s(%s)" % (result_type, command.name, params))
+            lines.append("    {")
+            lines.append("      return this->request->invoke<%s>(this->handler_id, 0x%02X%s);" % (
+                result_type, command.command_id, args))
+        lines.append("    }")
+    lines.append("    ArduRPCRequest")
+    lines.append("      *request;")
+    lines.append("    uint8_t")
+    lines.append("      handler_id;")
+    lines.append("};")
+    return lines
+
+
+def generate(schema, handler_types, device_name=None, handlers=None):
+    guard = "ARDURPC_STUBS_%s_H" % identifier(device_name or "ALL").upper()
+    lines = []
+    lines.append("/**")
+    lines.append(" * Generated by tools/ardurpc-stubgen.py. Do not edit.")
+    lines.append(" */")
+    lines.append("")
+    lines.append("#ifndef %s" % guard)
+    lines.append("#define %s" % guard)
+    lines.append("")
+    lines.append("#include <ArduRPC.h>")
+
+    for handler_type in handler_types:
+        lines.append("")
+        lines.extend(generate_class(handler_type, schema.commands(handler_type)))
+
+    if handlers is not None:
+        prefix = "RPC_DEVICE_%s" % identifier(device_name).upper()
+        class_name = "ArduRPCDevice_%s" % identifier(device_name)
+        lines.append("")
+        for handler in handlers:
+            name = identifier(handler["name"]).upper()
+            lines.append("#define %s_%s_ID 0x%02X" % (prefix, name, handler["id"]))
+            lines.append("#define %s_%s_TYPE 0x%04X" % (prefix, name, handler["type"]))
+        lines.append("")
+        lines.append("/**")
+        lines.append(" * Handlers of the device %s with their IDs at the time of generation." % device_name)
+        lines.append(" */")
+        lines.append("class %s" % class_name)
+        lines.append("{")
+        lines.append("  public:")
+        inits = []
+        for handler in handlers:
+            handler_type = schema.find_type(handler["type"])
+            if handler_type is None:
+                continue
+            inits.append("%s(request, 0x%02X)" % (identifier(handler["name"]), handler["id"]))
+        if inits:
+            lines.append("    %s(ArduRPCRequest &request) :" % class_name)
+            for i, init in enumerate(inits):
+                lines.append("      %s%s" % (init, "," if i < len(inits) - 1 else ""))
+            lines.append("    {")
+            lines.append("    }")
+        for handler in handlers:
+            handler_type = schema.find_type(handler["type"])
+            if handler_type is None:
+                lines.append("    // %s: unknown handler type 0x%04X" % (handler["name"], handler["type"]))
+                continue
+            lines.append("    %s" % handler_type.class_name)
+            lines.append("      %s;" % identifier(handler["name"]))
+        lines.append("};")
+
+    lines.append("")
+    lines.append("#endif")
+    return "\n".join(lines) + "\n"
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Generate typed client stubs for ArduRPCRequest")
+    parser.add_argument("--schema", default=DEFAULT_SCHEMA, help="Handler type documentation (default: %(default)s)")
+    parser.add_argument("--device", help="JSON description of the device")
+    parser.add_argument("--port", help="Read the handlers from a device on this serial port (requires pyserial)")
+    parser.add_argument("--baud", type=int, default=9600, help="Baud rate of the serial port")
+    parser.add_argument("--host", help="Read the handlers from a device at host:port")
+    parser.add_argument("--name", help="Name of the device")
+    parser.add_argument("--save-device", help="Write the handlers read from the device to a JSON description")
+    parser.add_argument("--cache", help="Directory to keep the handlers read from devices by their fingerprint")
+    parser.add_argument("--all", action="store_true", help="Generate stubs for all handler types of the schema")
+    parser.add_argument("-o", "--output", help="Output file (default: stdout)")
+    args = parser.parse_args()
+
+    schema = Schema(args.schema)
+    device_name = args.name
+    handlers = None
+    if args.device:
+        with open(args.device) as f:
+            device = json.load(f)
+        device_name = device_name or device.get("name", "Device")
+        handlers = device["handlers"]
+        for handler in handlers:
+            if isinstance(handler["type"], str):
+                handler["type"] = int(handler["type"], 0)
+    elif args.port or args.host:
+        device_name = device_name or "Device"
+        connection = Connection(port=args.port, baud=args.baud, host=args.host)
+        cache_file = None
+        if args.cache:
+            cache_file = os.path.join(args.cache, "%08x.json" % connection.fingerprint())
+        if cache_file is not None and os.path.exists(cache_file):
+            with open(cache_file) as f:
+                handlers = json.load(f)
+        else:
+            handlers = connection.handlers()
+            if cache_file is not None:
+                if not os.path.isdir(args.cache):
+                    os.makedirs(args.cache)
+                with open(cache_file, "w") as f:
+                    json.dump(handlers, f)
+        if args.save_device:
+            with open(args.save_device, "w") as f:
+                json.dump({
+                    "name": device_name,
+                    "handlers": [dict(h, type="0x%04X" % h["type"]) for h in handlers]
+                }, f, indent=4)
+                f.write("\n")
+    elif not args.all:
+        parser.error("One of --device, --port, --host or --all is required")
+
+    if handlers is None:
+        handler_types = schema.types
+    else:
+        handler_types = []
+        for handler in handlers:
+            handler_type = schema.find_type(handler["type"])
+            if handler_type is None:
+                sys.stderr.write("Unknown handler type 0x%04X of %s\n" % (handler["type"], handler["name"]))
+            elif handler_type not in handler_types:
+                handler_types.append(handler_type)
+
+    output = generate(schema, handler_types, device_name, handlers)
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(output)
+    else:
+        sys.stdout.write(output)
+
+
+if __name__ == "__main__":
+    main()